@@ -0,0 +1,116 @@
+"""
+Compile a corpus with several register allocators and compare compile time
+and the run time of the resulting binaries.
+
+e.g. python -m benchmark
+     python -m benchmark -a color1 greedy -r 10 --color1-flags="-color1-model=dl_regalloc_model.bin"
+
+Every program is lowered to IR once with clang -O1 (same as regalloc.sh), then
+llc runs once per allocator. Every llc run gets -ig-disable, so the
+X86IGGenerator pass neither builds nor writes graphs and its cost is not
+counted in any allocator's compile time. Compile and run times are the
+minimum over --repeat runs. A binary whose output differs from the greedy build is marked
+as wrong. Results go to stdout as a table and to --output as JSON.
+"""
+import argparse
+import json
+import os
+import shutil
+import subprocess
+import tempfile
+import time
+
+LLVM_BIN = "../llvm-project/build/bin"
+ALLOCATORS = ["color1", "greedy", "basic", "pbqp"]
+CORPUS = ["test3.c", "test4.c", "hw2correct5.c", "hw2correct6.c",
+          "kernels/matmul.c", "kernels/nbody.c", "kernels/crc32.c", "kernels/sort.c"]
+# test3 reads one number from stdin
+STDIN = {"test3.c": "5\n"}
+
+
+def timed(cmd, repeat, stdin=None):
+    """Run cmd repeat times; returns (best wall time in seconds, stdout of the last run)."""
+    best = None
+    for _ in range(repeat):
+        start = time.perf_counter()
+        result = subprocess.run(cmd, input=stdin, capture_output=True, text=True, check=True)
+        elapsed = time.perf_counter() - start
+        best = elapsed if best is None else min(best, elapsed)
+    return best, result.stdout
+
+
+def run_benchmark(source, allocators, repeat, workdir, color1_flags, llvm_bin):
+    name = os.path.splitext(os.path.basename(source))[0]
+    ll_file = os.path.join(workdir, name + ".ll")
+    subprocess.run(["clang", source, "-S", "-O1", "-emit-llvm", "-o", ll_file], check=True)
+
+    results = {}
+    for alloc in allocators:
+        obj = os.path.join(workdir, f"{name}.{alloc}.o")
+        exe = os.path.join(workdir, f"{name}.{alloc}")
+        # X86IGGenerator runs in every llc; keep its graph building and file
+        # output out of the timings
+        llc = [os.path.join(llvm_bin, "llc"), ll_file, "-march=x86-64", "-filetype=obj",
+               "-regalloc=" + alloc, "-ig-disable", "-o", obj]
+        if alloc == "color1":
+            llc += color1_flags.split()
+        try:
+            compile_time, _ = timed(llc, repeat)
+            subprocess.run(["gcc", obj, "-o", exe, "-no-pie", "-lm"], check=True)
+            run_time, output = timed([exe], repeat, STDIN.get(os.path.basename(source)))
+            results[alloc] = {"compile_s": compile_time, "run_s": run_time, "output": output}
+        except subprocess.CalledProcessError as e:
+            results[alloc] = {"error": f"{e.cmd[0]} exited with {e.returncode}"}
+
+    reference = results.get("greedy", {}).get("output")
+    for result in results.values():
+        if "output" in result:
+            output = result.pop("output")
+            result["correct"] = reference is None or output == reference
+    return results
+
+
+def print_table(report, allocators):
+    print(f"{'program':<16}" + "".join(f"{a + ' llc/run (ms)':>28}" for a in allocators))
+    for program, results in report.items():
+        row = f"{program:<16}"
+        for alloc in allocators:
+            r = results.get(alloc, {})
+            if "error" in r:
+                cell = "failed"
+            else:
+                cell = f"{r['compile_s'] * 1000:.1f} / {r['run_s'] * 1000:.1f}"
+                if not r["correct"]:
+                    cell += " WRONG"
+            row += f"{cell:>28}"
+        print(row)
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('-a', '--allocators', nargs='+', default=ALLOCATORS)
+    parser.add_argument('-f', '--files', nargs='+', default=CORPUS)
+    parser.add_argument('-r', '--repeat', default=5, type=int)
+    parser.add_argument('-o', '--output', default="benchmark.json", type=str)
+    parser.add_argument('--llvm-bin', default=LLVM_BIN, type=str)
+    parser.add_argument('--color1-flags', default="", type=str,
+                        help="extra llc flags for color1, e.g. -color1-model=dl_regalloc_model.bin")
+    args = parser.parse_args()
+
+    workdir = tempfile.mkdtemp(prefix="regalloc_bench_")
+    try:
+        report = {}
+        for source in args.files:
+            report[source] = run_benchmark(source, args.allocators, args.repeat, workdir,
+                                           args.color1_flags, args.llvm_bin)
+    finally:
+        shutil.rmtree(workdir)
+
+    print_table(report, args.allocators)
+    print("llc times exclude X86IGGenerator (run with -ig-disable)")
+    with open(args.output, 'w') as f:
+        json.dump(report, f, indent=2)
+
+
+if __name__ == "__main__":
+    main()
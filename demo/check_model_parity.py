@@ -0,0 +1,77 @@
+import argparse
+import os
+import subprocess
+import sys
+import numpy as np
+import torch
+from model import DLRegAlloc
+from utils import (csr_to_adjacency, node_colors, process_model_output,
+                   read_ig_stream, read_predictions)
+
+
+def run_passes(c_file, weights, pred_file):
+    """
+    Write the graphs of c_file with X86IGGenerator, then run the RegAlloc pass
+    with the in-process model and let it dump the colors it predicted.
+    """
+    subprocess.run(["sh", "iggenerator.sh", c_file], check=True)
+    flags = ("-color1-model=" + os.path.abspath(weights)
+             + " -color1-dump-predictions=" + os.path.abspath(pred_file))
+    subprocess.run(["sh", "regalloc.sh", c_file, flags], check=True)
+
+def compare(records, predictions, model, device, names):
+    """
+    Color every graph in names with model.py and compare the colors with the
+    ones DLRegAllocModel predicted for it.
+    Returns the number of graphs whose colors differ.
+    """
+    mismatches = 0
+    for name in names:
+        vregs, num_nodes, offsets, neighbors = records[name]
+        pred_vregs, _, _, cpp_colors = predictions[name]
+        if not np.array_equal(vregs, pred_vregs):
+            print(f"{name}: graph differs between the two runs, skipped")
+            continue
+        x = csr_to_adjacency(num_nodes, offsets, neighbors)
+        model_input = torch.tensor(np.expand_dims(x, 0), dtype=torch.float32).to(device)
+        colors = node_colors(num_nodes, x, process_model_output(model_input, model)[0])
+        differ = [j for j in range(num_nodes) if colors[j] != cpp_colors[j]]
+        if differ:
+            mismatches += 1
+            print(f"{name}: {len(differ)} of {num_nodes} nodes differ, first at node {differ[0]}: "
+                  f"model.py {colors[differ[0]]}, DLRegAllocModel {cpp_colors[differ[0]]}")
+        else:
+            print(f"{name}: {num_nodes} nodes match")
+    return mismatches
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Check that the RegAlloc pass (-color1-model) colors a graph like model.py")
+    parser.add_argument('-f', '--file', required=True, type=str, help="c file to compile")
+    parser.add_argument('-w', '--weights', default="dl_regalloc_model.bin", type=str,
+                        help="weights from export_model.py")
+    parser.add_argument('-m', '--model', default="dl_regalloc_model.pth", type=str)
+    parser.add_argument('-r', '--record', default=None, type=str,
+                        help="graph to check, e.g. main#0; all predicted graphs by default")
+    args = parser.parse_args()
+
+    c_file = args.file.split(".")[0]
+    pred_file = c_file + "_model.igp"
+    run_passes(c_file, args.weights, pred_file)
+    records = read_ig_stream(c_file + "_ig.igb")
+    predictions = read_predictions(pred_file)
+    names = [args.record] if args.record else list(predictions)
+    missing = [name for name in names if name not in records or name not in predictions]
+    if missing:
+        sys.exit(f"no graph or prediction for {', '.join(missing)}")
+
+    device = "cuda" if torch.cuda.is_available() else "cpu"
+    model = DLRegAlloc().to(device)
+    model.load_state_dict(torch.load(f=args.model, map_location=device))
+    mismatches = compare(records, predictions, model, device, names)
+    print(f"{len(names) - mismatches} of {len(names)} graphs match")
+    sys.exit(1 if mismatches else 0)
+
+
+if __name__ == "__main__":
+    main()
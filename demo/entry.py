@@ -1,37 +1,53 @@
 import argparse
 import os
 import subprocess
+import numpy as np
 import torch
-import csv
 from model import DLRegAlloc
-from utils import process_model_input, process_model_output
+from utils import (csr_to_adjacency, node_colors, process_model_output,
+                   read_ig_stream, write_predictions)
 
 
 def run_X86IGGenerator(c_file):
     """
-    Generate interference graph and rename the file w.r.t. c_file name.
-    The content in the interference graph follows the format below:
-        #, 200 long, 100 #
+    Generate the interference graphs of c_file into <c_file>_ig.igb.
+    The file holds one record (graph + vreg table) per function and register
+    class partition, named "function#partition", see utils.read_ig_stream.
     """
     subprocess.run(["sh", "iggenerator.sh", c_file])
-    os.rename("interference.csv", c_file + "_ig.csv")
 
-def run_DL_model(ig_file):
+def run_DL_model(records):
+    """
+    Predict colors for every record of the stream; each partition of a
+    function is a separate model input.
+    Returns {record name: [color per node, 0 where the model has none]}.
+    """
     device = "cuda" if torch.cuda.is_available() else "cpu"
     print("Using", device, "...\n")
     loaded_model = DLRegAlloc().to(device)
     loaded_model.load_state_dict(torch.load(f="dl_regalloc_model.pth"))
-    model_input = process_model_input(ig_file, device) # shape(1, 100, 100)
-    model_output = process_model_output(model_input, loaded_model)
-    model_output = model_output[0]
+    model_output = {}
+    for name, (_, num_nodes, offsets, neighbors) in records.items():
+        x = csr_to_adjacency(num_nodes, offsets, neighbors)
+        if not x.any():
+            # no edges, nothing to color
+            model_output[name] = [0] * num_nodes
+            continue
+        model_input = torch.tensor(np.expand_dims(x, 0), dtype=torch.float32).to(device) # shape(1, 100, 100)
+        colors_list = process_model_output(model_input, loaded_model)[0]
+        model_output[name] = node_colors(num_nodes, x, colors_list)
     return model_output
 
-def run_regalloc_pass(c_file):
-    subprocess.run(["sh", "regalloc.sh", c_file])
+def run_regalloc_pass(c_file, llc_flags=""):
+    subprocess.run(["sh", "regalloc.sh", c_file, llc_flags])
 
 def main():
     parser = argparse.ArgumentParser()
     parser.add_argument('-f', '--file', default=None, type=str)
+    parser.add_argument('-w', '--weights', default=None, type=str,
+                        help="weights from export_model.py; run the model inside the RegAlloc pass")
+    parser.add_argument('-s', '--server', default=None, type=str,
+                        help="socket of a running inference_server.py; the RegAlloc pass asks it for colors")
     args = parser.parse_args()
 
     print("Demo starting...\n")
@@ -42,30 +58,34 @@ def main():
         c_file = input("Provide c file name: ")
         print()
     c_file = c_file.split(".")[0]
+
+    if args.weights is not None:
+        # The RegAlloc pass builds the graph and runs the model by itself
+        print("Run RegAlloc Pass with in-process model...")
+        run_regalloc_pass(c_file, "-color1-model=" + os.path.abspath(args.weights))
+        return
+    if args.server is not None:
+        print("Run RegAlloc Pass with inference server...")
+        run_regalloc_pass(c_file, "-color1-server=" + os.path.abspath(args.server))
+        return
     
     # run X86IGGenerator pass on the c_file
     run_X86IGGenerator(c_file)
     print()
 
     # run deep learning model
-    model_output = run_DL_model(c_file + "_ig.csv")
+    records = read_ig_stream(c_file + "_ig.igb")
+    model_output = run_DL_model(records)
     # run_DL_model("baidu.csv")
 
-    # write to csv
-    first_flag = True
-    with open('model_output.csv', 'w') as output_file:
-        for color in model_output:
-            if first_flag:
-                output_file.write(str(color))
-                first_flag = False
-            else:
-                output_file.write(", " + str(color))
+    # the RegAlloc pass maps this file (-color1-predictions)
+    write_predictions("model_output.igp", records, model_output)
     
     print()
     print()
     print("Run RegAlloc Pass...")
 
-    run_regalloc_pass(c_file)
+    run_regalloc_pass(c_file, "-color1-predictions=" + os.path.abspath("model_output.igp"))
 
 
 if __name__ == "__main__":
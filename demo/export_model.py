@@ -0,0 +1,45 @@
+import argparse
+import struct
+import torch
+from model import DLRegAlloc
+
+
+LSTM_LAYERS = ["lstm_1", "lstm_2", "lstm_3"]
+
+def export_weights(pth_file, out_file, seq_size=100):
+    """
+    Write the weights of a DLRegAlloc checkpoint for the in-process inference 
+    engine of the RegAlloc pass (DLRegAllocModel.h). All fields are little-endian:
+        "DLRA", version, seq_size, # of classes, # of layers, (input, hidden) per layer,
+        float32 weight_ih, weight_hh, bias_ih, bias_hh per layer and direction,
+        float32 fc.weight, fc.bias
+    """
+    model = DLRegAlloc()
+    model.load_state_dict(torch.load(f=pth_file, map_location="cpu"))
+    state = model.state_dict()
+
+    with open(out_file, "wb") as f:
+        f.write(b"DLRA")
+        f.write(struct.pack("<4I", 1, seq_size, model.fc.out_features, len(LSTM_LAYERS)))
+        for name in LSTM_LAYERS:
+            lstm = getattr(model, name)
+            f.write(struct.pack("<2I", lstm.input_size, lstm.hidden_size))
+        for name in LSTM_LAYERS:
+            for suffix in ["_l0", "_l0_reverse"]:
+                for kind in ["weight_ih", "weight_hh", "bias_ih", "bias_hh"]:
+                    tensor = state[f"{name}.{kind}{suffix}"]
+                    f.write(tensor.detach().numpy().astype("<f4").tobytes())
+        f.write(state["fc.weight"].detach().numpy().astype("<f4").tobytes())
+        f.write(state["fc.bias"].detach().numpy().astype("<f4").tobytes())
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('-i', '--input', default="dl_regalloc_model.pth", type=str)
+    parser.add_argument('-o', '--output', default="dl_regalloc_model.bin", type=str)
+    args = parser.parse_args()
+    export_weights(args.input, args.output)
+    print("Wrote", args.output)
+
+
+if __name__ == "__main__":
+    main()
@@ -9,7 +9,7 @@ rm -f default.profraw *_prof *_fplicm *.bc *.profdata *_output *.ll *.s
 
 # Convert source code to bitcode (IR).
 clang ${1}.c -S -O1 -emit-llvm -o ${1}.ll
-../llvm-project/build/bin/llc ${1}.ll -march=x86-64 -o ${1}.s
+../llvm-project/build/bin/llc ${1}.ll -march=x86-64 -ig-output=${1}_ig.igb -o ${1}.s
 clang ${1}.s -o ${1} -no-pie
 ./${1}
 
@@ -0,0 +1,145 @@
+"""
+Long-lived inference daemon for the RegAlloc pass (llc -regalloc=color1 
+-color1-server=<socket>). The model is loaded once; graphs sent by concurrent
+llc processes are batched into one [B, 100, 100] forward pass.
+
+Protocol (one request per connection, little-endian uint32):
+    request: "IGQ1", N, E, offsets[N+1], neighbors[2E]   (CSR graph)
+    reply:   "IGR1", N, colors[N]   (0 for nodes the model does not see)
+    request: "IGD1"
+    reply:   "IGD1", digest (8 bytes, BLAKE2b of the weights file), which
+             -color1-cache puts into its keys
+    reply:   "IGE1" instead of the above when the request is unknown or the
+             model failed on it, so llc can tell it from a dead server
+"""
+
+import argparse
+import hashlib
+import os
+import queue
+import socketserver
+import struct
+import threading
+import time
+import numpy as np
+import torch
+from model import DLRegAlloc
+from utils import process_model_output, csr_to_adjacency, node_colors
+
+
+def recv_exactly(sock, size):
+    data = bytearray()
+    while len(data) < size:
+        chunk = sock.recv(size - len(data))
+        if not chunk:
+            raise ConnectionError("connection closed")
+        data += chunk
+    return bytes(data)
+
+class BatchingPredictor:
+    def __init__(self, model, device, max_batch, max_wait):
+        self.model = model
+        self.device = device
+        self.max_batch = max_batch
+        self.max_wait = max_wait
+        self.requests = queue.Queue()
+        threading.Thread(target=self._run, daemon=True).start()
+
+    def predict(self, graph):
+        """
+        graph: (N, offsets, neighbors). Blocks until the batch it joined is done.
+        """
+        item = {"graph": graph, "colors": None, "done": threading.Event()}
+        self.requests.put(item)
+        item["done"].wait()
+        return item["colors"]
+
+    def _collect(self):
+        batch = [self.requests.get()]
+        deadline = time.monotonic() + self.max_wait
+        while len(batch) < self.max_batch:
+            timeout = deadline - time.monotonic()
+            if timeout <= 0:
+                break
+            try:
+                batch.append(self.requests.get(timeout=timeout))
+            except queue.Empty:
+                break
+        return batch
+
+    def _run(self):
+        while True:
+            batch = self._collect()
+            # Every graph of a failed batch gets None, which the handler
+            # turns into an "IGE1" reply
+            results = [None] * len(batch)
+            try:
+                X = np.stack([csr_to_adjacency(*item["graph"]) for item in batch])
+                # Graphs without any edge need no colors
+                todo = [i for i in range(len(batch)) if X[i].any()]
+                colors_list_list = []
+                if todo:
+                    model_input = torch.tensor(X[todo], dtype=torch.float32).to(self.device)
+                    colors_list_list = process_model_output(model_input, self.model)
+                print(f"Batch of {len(batch)} graphs, {len(todo)} sent to the model")
+                colors = [[0] * item["graph"][0] for item in batch]
+                for i, colors_list in zip(todo, colors_list_list):
+                    colors[i] = node_colors(batch[i]["graph"][0], X[i], colors_list)
+                results = colors
+            except Exception as e:
+                print("Inference failed:", e)
+            for item, colors in zip(batch, results):
+                item["colors"] = colors
+                item["done"].set()
+
+class RequestHandler(socketserver.BaseRequestHandler):
+    def handle(self):
+        magic = recv_exactly(self.request, 4)
+        if magic == b"IGD1":
+            self.request.sendall(b"IGD1" + self.server.weights_digest)
+            return
+        if magic != b"IGQ1":
+            self.request.sendall(b"IGE1")
+            return
+        num_nodes, num_edges = struct.unpack("<2I", recv_exactly(self.request, 8))
+        body = recv_exactly(self.request, 4 * (num_nodes + 1 + 2 * num_edges))
+        words = np.frombuffer(body, dtype='<u4')
+        offsets = words[:num_nodes + 1]
+        neighbors = words[num_nodes + 1:]
+        colors = self.server.predictor.predict((num_nodes, offsets, neighbors))
+        if colors is None:
+            self.request.sendall(b"IGE1")
+            return
+        reply = b"IGR1" + struct.pack(f"<{num_nodes + 1}I", num_nodes, *colors)
+        self.request.sendall(reply)
+
+class InferenceServer(socketserver.ThreadingUnixStreamServer):
+    daemon_threads = True
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('-s', '--socket', default="/tmp/dl_regalloc.sock", type=str)
+    parser.add_argument('-m', '--model', default="dl_regalloc_model.pth", type=str)
+    parser.add_argument('-b', '--max-batch', default=32, type=int)
+    parser.add_argument('-t', '--max-wait-ms', default=5, type=float)
+    args = parser.parse_args()
+
+    device = "cuda" if torch.cuda.is_available() else "cpu"
+    print("Using", device, "...\n")
+    model = DLRegAlloc().to(device)
+    model.load_state_dict(torch.load(f=args.model, map_location=device))
+    with open(args.model, "rb") as f:
+        weights_digest = hashlib.blake2b(f.read(), digest_size=8).digest()
+
+    if os.path.exists(args.socket):
+        os.unlink(args.socket)
+    with InferenceServer(args.socket, RequestHandler) as server:
+        server.weights_digest = weights_digest
+        server.predictor = BatchingPredictor(model, device, args.max_batch,
+                                             args.max_wait_ms / 1000)
+        print("Listening on", args.socket)
+        server.serve_forever()
+
+
+if __name__ == "__main__":
+    main()
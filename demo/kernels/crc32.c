@@ -0,0 +1,30 @@
+#include <stdint.h>
+#include <stdio.h>
+
+#define SIZE (1 << 20)
+
+static uint8_t data[SIZE];
+static uint32_t table[256];
+
+int main() {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+            c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        table[i] = c;
+    }
+    uint32_t seed = 12345;
+    for (int i = 0; i < SIZE; i++) {
+        seed = seed * 1103515245u + 12345u;
+        data[i] = seed >> 16;
+    }
+    uint32_t crc = 0;
+    for (int rep = 0; rep < 32; rep++) {
+        crc = ~crc;
+        for (int i = 0; i < SIZE; i++)
+            crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+        crc = ~crc;
+    }
+    printf("crc %08x\n", crc);
+    return 0;
+}
@@ -0,0 +1,26 @@
+#include <stdio.h>
+
+#define N 256
+
+static double A[N][N], B[N][N], C[N][N];
+
+int main() {
+    for (int i = 0; i < N; i++)
+        for (int j = 0; j < N; j++) {
+            A[i][j] = (i * 7 + j * 3) % 17 - 8;
+            B[i][j] = (i * 5 + j * 11) % 13 - 6;
+        }
+    for (int rep = 0; rep < 4; rep++)
+        for (int i = 0; i < N; i++)
+            for (int k = 0; k < N; k++) {
+                double a = A[i][k];
+                for (int j = 0; j < N; j++)
+                    C[i][j] += a * B[k][j];
+            }
+    double sum = 0;
+    for (int i = 0; i < N; i++)
+        for (int j = 0; j < N; j++)
+            sum += C[i][j] * ((i ^ j) & 7);
+    printf("checksum %.1f\n", sum);
+    return 0;
+}
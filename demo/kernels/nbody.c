@@ -0,0 +1,45 @@
+#include <math.h>
+#include <stdio.h>
+
+#define BODIES 64
+#define STEPS 2000
+
+static double x[BODIES], y[BODIES], z[BODIES];
+static double vx[BODIES], vy[BODIES], vz[BODIES], m[BODIES];
+
+int main() {
+    for (int i = 0; i < BODIES; i++) {
+        x[i] = (i % 7) - 3.0;
+        y[i] = (i % 5) - 2.0;
+        z[i] = (i % 3) - 1.0 + i * 0.01;
+        vx[i] = vy[i] = vz[i] = 0;
+        m[i] = 1.0 + (i % 4) * 0.25;
+    }
+    const double dt = 0.001, eps = 0.01;
+    for (int s = 0; s < STEPS; s++) {
+        for (int i = 0; i < BODIES; i++) {
+            double ax = 0, ay = 0, az = 0;
+            for (int j = 0; j < BODIES; j++) {
+                double dx = x[j] - x[i], dy = y[j] - y[i], dz = z[j] - z[i];
+                double d2 = dx * dx + dy * dy + dz * dz + eps;
+                double inv = m[j] / (d2 * sqrt(d2));
+                ax += dx * inv;
+                ay += dy * inv;
+                az += dz * inv;
+            }
+            vx[i] += ax * dt;
+            vy[i] += ay * dt;
+            vz[i] += az * dt;
+        }
+        for (int i = 0; i < BODIES; i++) {
+            x[i] += vx[i] * dt;
+            y[i] += vy[i] * dt;
+            z[i] += vz[i] * dt;
+        }
+    }
+    double e = 0;
+    for (int i = 0; i < BODIES; i++)
+        e += 0.5 * m[i] * (vx[i] * vx[i] + vy[i] * vy[i] + vz[i] * vz[i]);
+    printf("energy %.6f\n", e);
+    return 0;
+}
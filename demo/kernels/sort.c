@@ -0,0 +1,45 @@
+#include <stdio.h>
+
+#define SIZE 1000000
+
+static int a[SIZE], tmp[SIZE];
+
+static void merge_sort(int lo, int hi) {
+    if (hi - lo < 16) {
+        for (int i = lo + 1; i < hi; i++) {
+            int v = a[i], j = i - 1;
+            while (j >= lo && a[j] > v) {
+                a[j + 1] = a[j];
+                j--;
+            }
+            a[j + 1] = v;
+        }
+        return;
+    }
+    int mid = lo + (hi - lo) / 2;
+    merge_sort(lo, mid);
+    merge_sort(mid, hi);
+    int i = lo, j = mid, k = lo;
+    while (i < mid && j < hi)
+        tmp[k++] = a[i] <= a[j] ? a[i++] : a[j++];
+    while (i < mid)
+        tmp[k++] = a[i++];
+    while (j < hi)
+        tmp[k++] = a[j++];
+    for (k = lo; k < hi; k++)
+        a[k] = tmp[k];
+}
+
+int main() {
+    unsigned seed = 42;
+    for (int i = 0; i < SIZE; i++) {
+        seed = seed * 1664525u + 1013904223u;
+        a[i] = (int)(seed >> 8);
+    }
+    merge_sort(0, SIZE);
+    long long sum = 0;
+    for (int i = 0; i < SIZE; i += 1000)
+        sum += a[i];
+    printf("sorted %d, sample sum %lld\n", a[0] <= a[SIZE - 1], sum);
+    return 0;
+}
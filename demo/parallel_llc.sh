@@ -0,0 +1,22 @@
+#!/bin/bash
+# Split a module and run code generation on N cores at once
+# e.g. sh parallel_llc.sh test4 8 -regalloc=color1
+# ${2} is the number of parts (default: all cores), ${3} passes extra llc flags.
+# Every llc process writes its own interference.<pid>.igb; read them together
+# with utils.read_ig_streams.
+
+N=${2:-$(nproc)}
+LLVM_BIN=../llvm-project/build/bin
+
+rm -f ${1}.part* interference.*.igb
+
+# Convert source code to bitcode (IR) and split it into N modules.
+clang ${1}.c -S -O1 -emit-llvm -o ${1}.ll
+${LLVM_BIN}/llvm-split -j ${N} -preserve-locals ${1}.ll -o ${1}.part
+
+ls ${1}.part* | xargs -P ${N} -I{} \
+    ${LLVM_BIN}/llc {} -march=x86-64 -filetype=obj ${3} -ig-output=interference.%p.igb -o {}.o
+gcc ${1}.part*.o -o ${1} -no-pie
+./${1}
+
+rm -f ${1}.ll ${1}.part*
@@ -9,7 +9,8 @@
 
 # Convert source code to bitcode (IR).
 clang ${1}.c -S -O1 -emit-llvm -o ${1}.ll
-../llvm-project/build/bin/llc ${1}.ll -march=x86-64 -regalloc=color1 -o ${1}.s
+# ${2} passes extra llc flags, e.g. -color1-model=dl_regalloc_model.bin
+../llvm-project/build/bin/llc ${1}.ll -march=x86-64 -regalloc=color1 ${2} -o ${1}.s
 gcc ${1}.s -o ${1} -no-pie
 ./${1}
 rm -f default.profraw *_prof *_fplicm *.bc *.profdata *_output *.ll *.s
@@ -0,0 +1,66 @@
+"""
+Generate labeled training graphs from a corpus of C or LLVM IR files.
+
+e.g. python -m training_data -d training_data -j 32 -a greedy ../corpus/*.c
+
+Every file is lowered to IR with clang -O1 (same as regalloc.sh), then llc
+compiles it with the reference allocator (--allocator) and X86IGGenerator
+running before the rewriter with -ig-training-data. Each llc writes its own
+shards into --data-dir, so any number of workers (and runs) can share it.
+Read the result with utils.read_training_shards.
+"""
+import argparse
+import glob
+import os
+import subprocess
+import tempfile
+from concurrent.futures import ThreadPoolExecutor
+
+LLVM_BIN = "../llvm-project/build/bin"
+
+
+def label_file(source, args, workdir):
+    """Compile one file; returns an error message or None."""
+    ll_file = source
+    try:
+        if not source.endswith(".ll"):
+            ll_file = os.path.join(workdir, f"{abs(hash(source))}.ll")
+            subprocess.run(["clang", source, "-S", "-O1", "-emit-llvm", "-o", ll_file],
+                           check=True, capture_output=True)
+        subprocess.run([os.path.join(args.llvm_bin, "llc"), ll_file, "-march=x86-64",
+                        "-filetype=obj", "-o", os.devnull, "-regalloc=" + args.allocator,
+                        "-ig-training-data=" + os.path.abspath(args.data_dir),
+                        f"-ig-shard-mb={args.shard_mb}"], check=True, capture_output=True)
+    except subprocess.CalledProcessError as e:
+        return f"{source}: {e.cmd[0]} exited with {e.returncode}"
+    finally:
+        if ll_file != source and os.path.exists(ll_file):
+            os.remove(ll_file)
+    return None
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('files', nargs='+')
+    parser.add_argument('-d', '--data-dir', default="training_data", type=str)
+    parser.add_argument('-a', '--allocator', default="greedy", choices=["greedy", "color1"])
+    parser.add_argument('-j', '--jobs', default=os.cpu_count(), type=int)
+    parser.add_argument('--shard-mb', default=64, type=int)
+    parser.add_argument('--llvm-bin', default=LLVM_BIN, type=str)
+    args = parser.parse_args()
+
+    workdir = tempfile.mkdtemp(prefix="regalloc_train_")
+    try:
+        with ThreadPoolExecutor(args.jobs) as pool:
+            errors = [e for e in pool.map(lambda f: label_file(f, args, workdir), args.files) if e]
+    finally:
+        os.rmdir(workdir)
+    for e in errors:
+        print(e)
+
+    shards = glob.glob(os.path.join(args.data_dir, "shard-*.igt"))
+    print(f"{len(args.files) - len(errors)} files compiled, {len(shards)} shards in {args.data_dir}")
+
+
+if __name__ == "__main__":
+    main()
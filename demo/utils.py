@@ -1,5 +1,9 @@
+import glob
 import matplotlib.pyplot as plt
+import os
 import pickle
+import struct
+import zlib
 import torch
 import numpy as np
 import pandas as pd
@@ -35,12 +39,167 @@ def process_model_output(model_input, loaded_model):
         post_process(np.asarray(x_pred), predicted)
         return colors_list_list_after_correction
 
-def process_model_input(ig_file, device, seq_size=100):
+def read_ig_stream(ig_file):
     """
-    input: #, 200 long, 100 #
+    Memory-map an interference graph stream written by X86IGGenerator.
+    Layout (little-endian uint32): "IGB1", version, then one record per function
+    and register class partition (vregs that share no register unit with any
+    other partition, e.g. GR* and VR*):
+        size, name length, name (padded to 4), N, E, vregs[N], offsets[N+1], neighbors[2E]
+    output: {"function#partition": (vregs, N, offsets, neighbors)}. The arrays are views 
+    into the mapped file; offsets/neighbors are CSR arrays.
+    """
+    buf = np.memmap(ig_file, dtype=np.uint8, mode='r')
+    if buf.size < 8 or buf.size % 4 or bytes(buf[:4]) != b'IGB1':
+        raise ValueError(f"{ig_file}: not an interference graph file")
+    words = np.frombuffer(buf, dtype='<u4')
+    if words[1] != 3:
+        raise ValueError(f"{ig_file}: unsupported version {words[1]}")
+    records = {}
+    pos = 2
+    while pos < words.size:
+        name, record, pos = _parse_ig_record(words, pos, ig_file)
+        records[name] = record
+    return records
+
+def _parse_ig_record(words, pos, source):
+    """
+    Parse the IGB record starting at words[pos].
+    output: (name, (vregs, N, offsets, neighbors), index of the next word)
+    """
+    end = pos + 1 + int(words[pos]) // 4
+    if end > words.size:
+        raise ValueError(f"{source}: truncated record")
+    name_len = int(words[pos + 1])
+    name = words[pos + 2:pos + 2 + (name_len + 3) // 4].tobytes()[:name_len].decode()
+    p = pos + 2 + (name_len + 3) // 4
+    num_nodes, num_edges = int(words[p]), int(words[p + 1])
+    p += 2
+    if p + num_nodes + num_nodes + 1 + 2 * num_edges != end:
+        raise ValueError(f"{source}: record size mismatch for {name}")
+    vregs = words[p:p + num_nodes]
+    offsets = words[p + num_nodes:p + 2 * num_nodes + 1]
+    neighbors = words[p + 2 * num_nodes + 1:end]
+    return name, (vregs, num_nodes, offsets, neighbors), end
+
+def read_training_shards(data_dir):
+    """
+    Read the labeled graphs written by X86IGGenerator with -ig-training-data.
+    Every shard-*.igt holds "IGT1", version, codec (0 stored, 1 zlib), then one
+    block per record: stored size, record size, bytes padded to 4. A record is
+    an IGB record followed by labels[N]: the register class each node was
+    given by the reference allocator, numbered from 1, or 0 if it was spilled.
+    The shard-*.idx files index the blocks for random access; a sequential
+    read does not need them.
+    output: yields (name, vregs, N, offsets, neighbors, labels)
+    """
+    for shard in sorted(glob.glob(os.path.join(data_dir, "shard-*.igt"))):
+        words = np.fromfile(shard, dtype='<u4')
+        if words.size < 3 or words[:1].tobytes() != b'IGT1' or words[1] != 1:
+            raise ValueError(f"{shard}: not a training data shard")
+        compressed = words[2] == 1
+        pos = 3
+        while pos < words.size:
+            stored, raw = int(words[pos]), int(words[pos + 1])
+            end = pos + 2 + (stored + 3) // 4
+            block = words[pos + 2:end].tobytes()[:stored]
+            pos = end
+            data = zlib.decompress(block) if compressed else block
+            if len(data) != raw:
+                raise ValueError(f"{shard}: corrupt block")
+            record = np.frombuffer(data, dtype='<u4')
+            name, (vregs, num_nodes, offsets, neighbors), end = _parse_ig_record(record, 0, shard)
+            yield name, vregs, num_nodes, offsets, neighbors, record[end:end + num_nodes]
+
+def read_ig_streams(ig_files):
+    """
+    Merge the streams written by parallel llc runs (see parallel_llc.sh), one
+    file per process/thread. Every function lives in exactly one of them.
+    output: {"function#partition": (vregs, N, offsets, neighbors)}
+    """
+    records = {}
+    for ig_file in ig_files:
+        records.update(read_ig_stream(ig_file))
+    return records
+
+def csr_to_adjacency(num_nodes, offsets, neighbors, seq_size=100):
+    """
+    output: shape(seq_size, seq_size). Same encoding as adBits: x[j][k] = 1 for 
+    an edge and x[j][j] = 1 for every node that has at least one edge.
+    """
+    x = np.zeros((seq_size, seq_size))
+    for j in range(min(num_nodes, seq_size)):
+        row = neighbors[offsets[j]:offsets[j + 1]]
+        row = row[row < seq_size]
+        if len(row):
+            x[j][row] = 1
+            x[j][j] = 1
+    return x
+
+def node_colors(num_nodes, x, colors_list, seq_size=100):
+    """
+    Spread the colors of the valid nodes (x[j][j] == 1) back over all nodes.
+    """
+    colors = iter(colors_list)
+    return [int(next(colors)) if j < seq_size and x[j][j] else 0 for j in range(num_nodes)]
+
+def write_predictions(pred_file, records, colors):
+    """
+    Write the colors for the RegAlloc pass (-color1-predictions).
+    input: records from read_ig_stream, and {record name: [color per node]}
+    Layout (little-endian uint32): "IGP1", version, then one record per graph:
+        size, name length, name (padded to 4), N, E, vregs[N], colors[N]
+    N, E and vregs repeat the graph record, so the pass can check that the
+    colors belong to the graph it is coloring.
+    """
+    with open(pred_file, 'wb') as f:
+        f.write(b'IGP1' + struct.pack('<I', 1))
+        for name, node_colors_list in colors.items():
+            vregs, num_nodes, offsets, neighbors = records[name]
+            if len(node_colors_list) != num_nodes:
+                raise ValueError(f"{name}: {len(node_colors_list)} colors for {num_nodes} nodes")
+            encoded = name.encode()
+            body = (struct.pack('<I', len(encoded)) + encoded + b'\0' * (-len(encoded) % 4)
+                    + struct.pack('<II', num_nodes, len(neighbors) // 2)
+                    + np.asarray(vregs, dtype='<u4').tobytes()
+                    + np.asarray(node_colors_list, dtype='<u4').tobytes())
+            f.write(struct.pack('<I', len(body)) + body)
+
+def read_predictions(pred_file):
+    """
+    Read a file written by write_predictions, or by the RegAlloc pass with
+    -color1-dump-predictions.
+    output: {record name: (vregs, N, E, colors)}
+    """
+    words = np.fromfile(pred_file, dtype='<u4')
+    if words.size < 2 or words[:1].tobytes() != b'IGP1' or words[1] != 1:
+        raise ValueError(f"{pred_file}: not a prediction file")
+    records = {}
+    pos = 2
+    while pos < words.size:
+        end = pos + 1 + int(words[pos]) // 4
+        name_len = int(words[pos + 1])
+        name = words[pos + 2:pos + 2 + (name_len + 3) // 4].tobytes()[:name_len].decode()
+        p = pos + 2 + (name_len + 3) // 4
+        num_nodes, num_edges = int(words[p]), int(words[p + 1])
+        if p + 2 + 2 * num_nodes != end or end > words.size:
+            raise ValueError(f"{pred_file}: record size mismatch for {name}")
+        records[name] = (words[p + 2:p + 2 + num_nodes], num_nodes, num_edges,
+                         words[p + 2 + num_nodes:end])
+        pos = end
+    return records
+
+def process_model_input(ig_file, device, seq_size=100, function="main#0"):
+    """
+    input: interference graph stream (.igb) and the record to read from it, 
+           or #, 200 long, 100 # (.csv)
     output: shape(1, 100, 100)
     """
     print(ig_file, "information:")
+    if ig_file.endswith(".igb"):
+        _, num_nodes, offsets, neighbors = read_ig_stream(ig_file)[function]
+        X = np.expand_dims(csr_to_adjacency(num_nodes, offsets, neighbors, seq_size), 0)
+        return torch.tensor(X, dtype=torch.float32).to(device)
     seq = pd.read_csv(ig_file, header=None, low_memory=False)
     columns = seq.columns.tolist()
     #get the adj edges
@@ -115,6 +274,19 @@ def updateLabelBits(x, y, seqsize=100):
 
 # ============================== Post Process ==================================
 
+def predicted_color(scores):
+    """
+    Color of one node: the argmax over the real colors. Class 0 is the padding
+    label, so it is never picked; DLRegAllocModel::predict uses the same rule.
+    """
+    return int(np.argmax(scores[1:])) + 1
+
+def set_predicted_color(scores, color):
+    """
+    Make color the argmax of the scores of one node.
+    """
+    scores[color] = scores.max() + 1
+
 def post_process (x2_pred, predicted, seqsize=100):
     #Calculate the number of edges which will require correction
     invCols = 0
@@ -125,7 +297,7 @@ def post_process (x2_pred, predicted, seqsize=100):
                 adj = x2_pred[i][j][k]
                 if (adj == 1):
                     edges += 1
-                    if (np.argmax(predicted[i][j]) == np.argmax(predicted[i][k])):
+                    if (predicted_color(predicted[i][j]) == predicted_color(predicted[i][k])):
                         invCols += 1
                         
     print('Total No of edges ', edges)
@@ -140,7 +312,7 @@ def post_process_chromatic (x2_pred, predicted, seqsize=100):
             # Valid nodes will have below set to 1 so check the color 
             # assignment of those nodes only
             if (x2_pred[i][j][j] != 0):
-                colors_list.append(np.argmax(predicted[i][j]))
+                colors_list.append(predicted_color(predicted[i][j]))
         # print('Colors list of graph ', i, ' is  \n', colors_list)
         chromatic_number = len(set(colors_list))
         # print('Chromatic number of graph ', i, ' is  ', chromatic_number)
@@ -172,9 +344,9 @@ def post_process_correction (x2_pred, predicted, colors_list_list, seqsize=100):
               #There is an edge
               if ( adj == 1 ):
                   edges += 1
-                  if ( np.argmax(predicted[i][j]) == np.argmax(predicted[i][k]) ):                   
-                      col_j = np.argmax(predicted[i][j])
-                      col_k = np.argmax(predicted[i][k])
+                  if ( predicted_color(predicted[i][j]) == predicted_color(predicted[i][k]) ):                   
+                      col_j = predicted_color(predicted[i][j])
+                      col_k = predicted_color(predicted[i][k])
                       invCols += 1
 
                       #Check whether we can give one of the existing colors
@@ -190,8 +362,8 @@ def post_process_correction (x2_pred, predicted, colors_list_list, seqsize=100):
                           #for  z in range(j):
                           for z in range(seqsize):
                               if j!=z:
-                                  if  (   ((x2_pred[i][j][z] == 1) and (np.argmax(predicted[i][z]) == y))
-                                      or  ((x2_pred[i][z][j] == 1) and (np.argmax(predicted[i][z]) == y))
+                                  if  (   ((x2_pred[i][j][z] == 1) and (predicted_color(predicted[i][z]) == y))
+                                      or  ((x2_pred[i][z][j] == 1) and (predicted_color(predicted[i][z]) == y))
                                       ):
                                       #print('[1] Adjacent node ... from ',j, '-->', z, 'color = ',xpredicted[i][z][0] )
                                       foundcol = 1
@@ -202,8 +374,7 @@ def post_process_correction (x2_pred, predicted, colors_list_list, seqsize=100):
                           #Color y is not used by any of j's neighbours
                           #print('[1] Finished Checking the adjacent node of ... ',j,' ... foundcol = ',foundcol)
                           if ( foundcol == 0 ) :
-                              #assign any prediction > 1
-                              predicted[i][j][y] = 2
+                              set_predicted_color(predicted[i][j], y)
                               #print('[1] Reuse color ', y, ' for node ', j)
                               foundfinalcol = 1
 
@@ -212,8 +383,8 @@ def post_process_correction (x2_pred, predicted, colors_list_list, seqsize=100):
                               #Check the adjacent nodes of k
                               for z in range(seqsize):
                                   if k!=z:
-                                      if  (   ((x2_pred[i][k][z] == 1) and (np.argmax(predicted[i][z]) == y))
-                                          or  ((x2_pred[i][z][k] == 1) and (np.argmax(predicted[i][z]) == y))
+                                      if  (   ((x2_pred[i][k][z] == 1) and (predicted_color(predicted[i][z]) == y))
+                                          or  ((x2_pred[i][z][k] == 1) and (predicted_color(predicted[i][z]) == y))
                                           ):
                                           #print('[1] Adjacent node ... from ',j, '-->', z, 'color = ',xpredicted[i][z][0] )
                                           foundcol = 1
@@ -221,8 +392,7 @@ def post_process_correction (x2_pred, predicted, colors_list_list, seqsize=100):
                                           break
                               #Color y is not used by any of k's neighbours
                               if ( foundcol == 0 ) :
-                                  #assign any prediction > 1
-                                  predicted[i][k][y] = 2
+                                  set_predicted_color(predicted[i][k], y)
                                   #print('[2] Reuse color ', y, ' for node ', k )
                                   foundfinalcol = 1
 
@@ -231,8 +401,7 @@ def post_process_correction (x2_pred, predicted, colors_list_list, seqsize=100):
                       if ( foundfinalcol == 0 ) :
                            #newCol += 1
                            mcolnew += 1
-                           #assign any prediction > 1
-                           predicted[i][k][mcolnew] = 2
+                           set_predicted_color(predicted[i][k], mcolnew)
                            maxcol +=1
                            #print('Use new color ', mcolnew, ' for node ', k)
 
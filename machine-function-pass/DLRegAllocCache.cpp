@@ -0,0 +1,114 @@
+#include "DLRegAllocCache.h"
+#include "DLRegAllocClient.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/EndianStream.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/xxhash.h"
+
+using namespace llvm;
+
+static const char IGCMagic[4] = {'I', 'G', 'C', '1'};
+static const uint32_t IGCVersion = 1;
+static const size_t IGCHeaderSize = 16;
+
+static uint64_t hashWords(ArrayRef<unsigned> Words) {
+  return xxHash64(ArrayRef<uint8_t>(
+      reinterpret_cast<const uint8_t *>(Words.data()), Words.size() * 4));
+}
+
+Expected<DLRegAllocCache> DLRegAllocCache::open(StringRef Dir,
+                                                StringRef ModelPath,
+                                                StringRef ServerPath) {
+  if (std::error_code EC = sys::fs::create_directories(Dir))
+    return createStringError(EC, "cannot create " + Dir);
+  DLRegAllocCache Cache;
+  Cache.Dir = Dir.str();
+  // Entries of different models must not mix. The server reports a digest
+  // of the weights it loaded, read once per process; a server restarted with
+  // other weights during a build is only noticed by the next llc.
+  if (!ServerPath.empty()) {
+    Expected<uint64_t> Digest = queryServerDigest(ServerPath);
+    if (!Digest)
+      return Digest.takeError();
+    char Bytes[8];
+    support::endian::write64le(Bytes, *Digest);
+    Cache.ModelKey = xxHash64(("server:" + StringRef(Bytes, 8)).str());
+  } else {
+    auto Weights = MemoryBuffer::getFile(ModelPath);
+    if (!Weights)
+      return createStringError(Weights.getError(), "cannot read " + ModelPath);
+    Cache.ModelKey = xxHash64((*Weights)->getBuffer());
+  }
+  return std::move(Cache);
+}
+
+uint64_t DLRegAllocCache::key(const SparseIG &G) const {
+  unsigned Shape[4] = {G.size(), G.numEdges(), 0, 0};
+  uint64_t Parts[4] = {ModelKey, hashWords(Shape), hashWords(G.Offsets),
+                       hashWords(G.Neighbors)};
+  return xxHash64(ArrayRef<uint8_t>(reinterpret_cast<const uint8_t *>(Parts),
+                                    sizeof(Parts)));
+}
+
+std::string DLRegAllocCache::entryPath(const SparseIG &G) const {
+  SmallString<256> Path(Dir);
+  sys::path::append(Path, utohexstr(key(G), /*LowerCase=*/true));
+  return std::string(Path);
+}
+
+bool DLRegAllocCache::lookup(const SparseIG &G,
+                             std::vector<unsigned> &Colors) const {
+  auto BufOrErr = MemoryBuffer::getFile(entryPath(G), /*IsText=*/false,
+                                        /*RequiresNullTerminator=*/false);
+  if (!BufOrErr)
+    return false;
+  StringRef Buf = (*BufOrErr)->getBuffer();
+  if (Buf.size() != IGCHeaderSize + (size_t)G.size() * 4 ||
+      Buf.substr(0, 4) != StringRef(IGCMagic, 4))
+    return false;
+  const char *P = Buf.data();
+  if (support::endian::read32le(P + 4) != IGCVersion ||
+      support::endian::read32le(P + 8) != G.size() ||
+      support::endian::read32le(P + 12) != G.numEdges())
+    return false;
+  Colors.resize(G.size());
+  for (unsigned i = 0; i < G.size(); i++)
+    Colors[i] = support::endian::read32le(P + IGCHeaderSize + 4 * i);
+  return true;
+}
+
+void DLRegAllocCache::store(const SparseIG &G,
+                            ArrayRef<unsigned> Colors) const {
+  if (Colors.size() != G.size())
+    return;
+  std::string Path = entryPath(G);
+  int FD;
+  SmallString<256> TmpPath;
+  if (sys::fs::createUniqueFile(Path + ".tmp-%%%%%%%%", FD, TmpPath))
+    return;
+  {
+    raw_fd_ostream OS(FD, /*shouldClose=*/true);
+    support::endian::Writer W(OS, support::little);
+    OS.write(IGCMagic, 4);
+    W.write<uint32_t>(IGCVersion);
+    W.write<uint32_t>(G.size());
+    W.write<uint32_t>(G.numEdges());
+    for (unsigned C : Colors)
+      W.write<uint32_t>(C);
+    OS.close();
+    if (OS.has_error()) {
+      OS.clear_error();
+      sys::fs::remove(TmpPath);
+      return;
+    }
+  }
+  // Concurrent writers of one key write the same bytes, so the last
+  // rename wins harmlessly.
+  if (sys::fs::rename(TmpPath, Path))
+    sys::fs::remove(TmpPath);
+}
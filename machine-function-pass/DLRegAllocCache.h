@@ -0,0 +1,46 @@
+// On-disk cache of predicted colorings, used by RegAlloc.cpp. Put this file
+// and DLRegAllocCache.cpp under "llvm-project/llvm/lib/CodeGen/".
+
+#ifndef LLVM_LIB_CODEGEN_DLREGALLOCCACHE_H
+#define LLVM_LIB_CODEGEN_DLREGALLOCCACHE_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/CodeGen/InterferenceGraph.h"
+#include "llvm/Support/Error.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace llvm {
+
+// Content-addressed cache of model colorings in a directory that any number
+// of llc processes may share. The key is the xxHash64 of the model (its
+// weight file, or the weights digest the server reports) and of the CSR
+// arrays of the graph, which only depend on the shape of the graph and not on
+// vreg numbers. Each entry is one file named by its key in hex, every field a
+// little-endian uint32:
+//   "IGC1", version, N, E, Colors[N]
+// Entries are written to a temporary file and renamed into place, so readers
+// never see a partial entry and take no locks. An entry that does not match
+// the graph is a miss.
+class DLRegAllocCache {
+  std::string Dir;
+  uint64_t ModelKey;
+
+  std::string entryPath(const SparseIG &G) const;
+
+public:
+  // Create Dir if needed.
+  static Expected<DLRegAllocCache> open(StringRef Dir, StringRef ModelPath,
+                                        StringRef ServerPath);
+
+  uint64_t key(const SparseIG &G) const;
+  bool lookup(const SparseIG &G, std::vector<unsigned> &Colors) const;
+  // Best effort: a failed write only costs a later miss.
+  void store(const SparseIG &G, ArrayRef<unsigned> Colors) const;
+};
+
+} // end namespace llvm
+
+#endif // LLVM_LIB_CODEGEN_DLREGALLOCCACHE_H
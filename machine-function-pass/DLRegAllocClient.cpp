@@ -0,0 +1,163 @@
+#include "DLRegAllocClient.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/EndianStream.h"
+#include "llvm/Support/raw_ostream.h"
+
+#ifdef LLVM_ON_UNIX
+#include <cerrno>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+using namespace llvm;
+
+#ifdef LLVM_ON_UNIX
+namespace {
+
+// Closes the socket on every exit path.
+struct SocketFD {
+  int FD;
+  ~SocketFD() {
+    if (FD >= 0)
+      ::close(FD);
+  }
+};
+
+Error socketError(const Twine &What) {
+  return make_error<StringError>(What + ": " + std::strerror(errno),
+                                 inconvertibleErrorCode());
+}
+
+// A server that went away must fail the request, not raise SIGPIPE and kill
+// llc, so writes go through send() with MSG_NOSIGNAL where it exists and the
+// socket is marked SO_NOSIGPIPE elsewhere (see connectTo).
+bool writeAll(int FD, const char *Data, size_t Size) {
+  while (Size) {
+#ifdef MSG_NOSIGNAL
+    ssize_t N = ::send(FD, Data, Size, MSG_NOSIGNAL);
+#else
+    ssize_t N = ::send(FD, Data, Size, 0);
+#endif
+    if (N < 0 && errno == EINTR)
+      continue;
+    if (N <= 0)
+      return false;
+    Data += N;
+    Size -= N;
+  }
+  return true;
+}
+
+// A server that closes the connection before the reply is complete leaves
+// errno untouched, so end of file gets its own message.
+Error readAll(int FD, char *Data, size_t Size) {
+  while (Size) {
+    ssize_t N = ::read(FD, Data, Size);
+    if (N < 0 && errno == EINTR)
+      continue;
+    if (N == 0)
+      return createStringError(inconvertibleErrorCode(),
+                               "unexpected EOF from inference server");
+    if (N < 0)
+      return socketError("read reply");
+    Data += N;
+    Size -= N;
+  }
+  return Error::success();
+}
+
+Error connectTo(StringRef SocketPath, SocketFD &Sock) {
+  sockaddr_un Addr = {};
+  Addr.sun_family = AF_UNIX;
+  if (SocketPath.size() >= sizeof(Addr.sun_path))
+    return createStringError(inconvertibleErrorCode(),
+                             "socket path too long");
+  std::memcpy(Addr.sun_path, SocketPath.data(), SocketPath.size());
+
+  Sock.FD = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (Sock.FD < 0)
+    return socketError("socket");
+#ifdef SO_NOSIGPIPE
+  int On = 1;
+  if (::setsockopt(Sock.FD, SOL_SOCKET, SO_NOSIGPIPE, &On, sizeof(On)) < 0)
+    return socketError("setsockopt");
+#endif
+  if (::connect(Sock.FD, reinterpret_cast<sockaddr *>(&Addr), sizeof(Addr)) < 0)
+    return socketError("connect to " + SocketPath);
+  return Error::success();
+}
+
+} // end anonymous namespace
+#endif
+
+Error llvm::queryColorServer(StringRef SocketPath, const SparseIG &G,
+                             std::vector<unsigned> &Colors) {
+#ifdef LLVM_ON_UNIX
+  SocketFD Sock{-1};
+  if (Error E = connectTo(SocketPath, Sock))
+    return E;
+
+  SmallString<1024> Request;
+  raw_svector_ostream OS(Request);
+  support::endian::Writer W(OS, support::little);
+  OS << "IGQ1";
+  W.write<uint32_t>(G.size());
+  W.write<uint32_t>(G.numEdges());
+  if (G.Offsets.empty())
+    W.write<uint32_t>(0);
+  for (unsigned O : G.Offsets)
+    W.write<uint32_t>(O);
+  for (unsigned V : G.Neighbors)
+    W.write<uint32_t>(V);
+  if (!writeAll(Sock.FD, Request.data(), Request.size()))
+    return socketError("send request");
+
+  // An error reply is only the tag, so read it before the node count.
+  char Header[8];
+  if (Error E = readAll(Sock.FD, Header, 4))
+    return E;
+  if (StringRef(Header, 4) == "IGE1")
+    return createStringError(inconvertibleErrorCode(),
+                             "inference server failed to color the graph");
+  if (Error E = readAll(Sock.FD, Header + 4, 4))
+    return E;
+  if (StringRef(Header, 4) != "IGR1" ||
+      support::endian::read32le(Header + 4) != G.size())
+    return createStringError(inconvertibleErrorCode(),
+                             "malformed reply from inference server");
+  std::vector<char> Body((size_t)G.size() * 4);
+  if (Error E = readAll(Sock.FD, Body.data(), Body.size()))
+    return E;
+  Colors.resize(G.size());
+  for (unsigned i = 0; i < G.size(); i++)
+    Colors[i] = support::endian::read32le(Body.data() + 4 * i);
+  return Error::success();
+#else
+  return createStringError(inconvertibleErrorCode(),
+                           "the inference server needs Unix domain sockets");
+#endif
+}
+
+Expected<uint64_t> llvm::queryServerDigest(StringRef SocketPath) {
+#ifdef LLVM_ON_UNIX
+  SocketFD Sock{-1};
+  if (Error E = connectTo(SocketPath, Sock))
+    return std::move(E);
+  if (!writeAll(Sock.FD, "IGD1", 4))
+    return socketError("send request");
+  char Reply[12];
+  if (Error E = readAll(Sock.FD, Reply, sizeof(Reply)))
+    return std::move(E);
+  if (StringRef(Reply, 4) != "IGD1")
+    return createStringError(inconvertibleErrorCode(),
+                             "malformed reply from inference server");
+  return support::endian::read64le(Reply + 4);
+#else
+  return createStringError(inconvertibleErrorCode(),
+                           "the inference server needs Unix domain sockets");
+#endif
+}
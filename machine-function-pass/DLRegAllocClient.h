@@ -0,0 +1,32 @@
+// Client for the batching inference server (demo/inference_server.py), used
+// by RegAlloc.cpp. Put this file and DLRegAllocClient.cpp under
+// "llvm-project/llvm/lib/CodeGen/".
+
+#ifndef LLVM_LIB_CODEGEN_DLREGALLOCCLIENT_H
+#define LLVM_LIB_CODEGEN_DLREGALLOCCLIENT_H
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/CodeGen/InterferenceGraph.h"
+#include "llvm/Support/Error.h"
+#include <cstdint>
+#include <vector>
+
+namespace llvm {
+
+// Send G to the server listening on the Unix domain socket SocketPath and
+// read back one color per node (0 for nodes the model does not see).
+// Protocol, one request per connection, every field a little-endian uint32:
+//   request: "IGQ1", N, E, Offsets[N + 1], Neighbors[2 * E]
+//   reply:   "IGR1", N, Colors[N], or "IGE1" if the model failed on G
+Error queryColorServer(StringRef SocketPath, const SparseIG &G,
+                       std::vector<unsigned> &Colors);
+
+// Ask the server for the digest of the weights it loaded, so colorings of
+// different models are never mixed up in the cache (DLRegAllocCache.h).
+//   request: "IGD1"
+//   reply:   "IGD1", Digest (8 bytes)
+Expected<uint64_t> queryServerDigest(StringRef SocketPath);
+
+} // end namespace llvm
+
+#endif // LLVM_LIB_CODEGEN_DLREGALLOCCLIENT_H
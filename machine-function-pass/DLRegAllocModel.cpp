@@ -0,0 +1,292 @@
+#include "DLRegAllocModel.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/bit.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include <algorithm>
+#include <cmath>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define DLRA_HAVE_AVX2 1
+#endif
+
+using namespace llvm;
+
+namespace {
+
+const char ModelMagic[4] = {'D', 'L', 'R', 'A'};
+const uint32_t ModelVersion = 1;
+
+// Y[c] += sum_r X[r] * A[r * Cols + c]. Rows whose X is zero are skipped,
+// which makes the 0/1 adjacency input and the initial zero state cheap.
+void gemvTScalar(const float *A, const float *X, unsigned Rows, unsigned Cols,
+                 float *Y) {
+  for (unsigned r = 0; r < Rows; r++) {
+    float S = X[r];
+    if (S == 0.0f)
+      continue;
+    const float *Row = A + (size_t)r * Cols;
+    for (unsigned c = 0; c < Cols; c++)
+      Y[c] += S * Row[c];
+  }
+}
+
+#ifdef DLRA_HAVE_AVX2
+// Same as gemvTScalar with 8-wide FMAs. Four rows are folded in per pass so
+// Y is loaded and stored once for every four rows.
+__attribute__((target("avx2,fma"))) void
+gemvTAVX2(const float *A, const float *X, unsigned Rows, unsigned Cols,
+          float *Y) {
+  SmallVector<unsigned, 256> Idx;
+  for (unsigned r = 0; r < Rows; r++)
+    if (X[r] != 0.0f)
+      Idx.push_back(r);
+
+  size_t i = 0;
+  for (; i + 4 <= Idx.size(); i += 4) {
+    const float *A0 = A + (size_t)Idx[i] * Cols;
+    const float *A1 = A + (size_t)Idx[i + 1] * Cols;
+    const float *A2 = A + (size_t)Idx[i + 2] * Cols;
+    const float *A3 = A + (size_t)Idx[i + 3] * Cols;
+    float X0 = X[Idx[i]], X1 = X[Idx[i + 1]];
+    float X2 = X[Idx[i + 2]], X3 = X[Idx[i + 3]];
+    __m256 S0 = _mm256_set1_ps(X0), S1 = _mm256_set1_ps(X1);
+    __m256 S2 = _mm256_set1_ps(X2), S3 = _mm256_set1_ps(X3);
+    unsigned c = 0;
+    for (; c + 8 <= Cols; c += 8) {
+      __m256 V = _mm256_loadu_ps(Y + c);
+      V = _mm256_fmadd_ps(S0, _mm256_loadu_ps(A0 + c), V);
+      V = _mm256_fmadd_ps(S1, _mm256_loadu_ps(A1 + c), V);
+      V = _mm256_fmadd_ps(S2, _mm256_loadu_ps(A2 + c), V);
+      V = _mm256_fmadd_ps(S3, _mm256_loadu_ps(A3 + c), V);
+      _mm256_storeu_ps(Y + c, V);
+    }
+    for (; c < Cols; c++)
+      Y[c] += X0 * A0[c] + X1 * A1[c] + X2 * A2[c] + X3 * A3[c];
+  }
+  for (; i < Idx.size(); i++) {
+    const float *A0 = A + (size_t)Idx[i] * Cols;
+    float X0 = X[Idx[i]];
+    __m256 S0 = _mm256_set1_ps(X0);
+    unsigned c = 0;
+    for (; c + 8 <= Cols; c += 8)
+      _mm256_storeu_ps(Y + c, _mm256_fmadd_ps(S0, _mm256_loadu_ps(A0 + c),
+                                              _mm256_loadu_ps(Y + c)));
+    for (; c < Cols; c++)
+      Y[c] += X0 * A0[c];
+  }
+}
+#endif
+
+using GemvFn = void (*)(const float *, const float *, unsigned, unsigned,
+                        float *);
+
+void gemvT(const float *A, const float *X, unsigned Rows, unsigned Cols,
+           float *Y) {
+  static const GemvFn Impl = [] {
+#ifdef DLRA_HAVE_AVX2
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+      return gemvTAVX2;
+#endif
+    return gemvTScalar;
+  }();
+  Impl(A, X, Rows, Cols, Y);
+}
+
+float sigmoid(float V) { return 1.0f / (1.0f + std::exp(-V)); }
+
+// Sequential reader over the weight file.
+struct WeightReader {
+  StringRef Data;
+  size_t Pos = 0;
+
+  bool readU32(uint32_t &V) {
+    if (Pos + 4 > Data.size())
+      return false;
+    V = support::endian::read32le(Data.data() + Pos);
+    Pos += 4;
+    return true;
+  }
+
+  bool readFloats(std::vector<float> &V, size_t Count) {
+    if (Data.size() - Pos < Count * 4)
+      return false;
+    V.resize(Count);
+    for (size_t i = 0; i < Count; i++, Pos += 4)
+      V[i] = bit_cast<float>(support::endian::read32le(Data.data() + Pos));
+    return true;
+  }
+
+  // Read a Rows x Cols row-major tensor and store it as Cols x Rows.
+  bool readTransposed(std::vector<float> &V, unsigned Rows, unsigned Cols) {
+    std::vector<float> Tmp;
+    if (!readFloats(Tmp, (size_t)Rows * Cols))
+      return false;
+    V.resize(Tmp.size());
+    for (unsigned r = 0; r < Rows; r++)
+      for (unsigned c = 0; c < Cols; c++)
+        V[(size_t)c * Rows + r] = Tmp[(size_t)r * Cols + c];
+    return true;
+  }
+};
+
+} // end anonymous namespace
+
+Expected<std::unique_ptr<DLRegAllocModel>>
+DLRegAllocModel::load(StringRef Path) {
+  auto BufOrErr = MemoryBuffer::getFile(Path, /*IsText=*/false,
+                                        /*RequiresNullTerminator=*/false);
+  if (!BufOrErr)
+    return errorCodeToError(BufOrErr.getError());
+  auto Fail = [&](const char *Msg) {
+    return make_error<StringError>(Path + ": " + Msg, inconvertibleErrorCode());
+  };
+
+  WeightReader R{(*BufOrErr)->getBuffer()};
+  if (!R.Data.startswith(StringRef(ModelMagic, sizeof(ModelMagic))))
+    return Fail("not a DLRegAlloc weight file");
+  R.Pos = sizeof(ModelMagic);
+  uint32_t Version, SeqLen, NumClasses, NumLayers;
+  if (!R.readU32(Version) || !R.readU32(SeqLen) || !R.readU32(NumClasses) ||
+      !R.readU32(NumLayers))
+    return Fail("truncated header");
+  if (Version != ModelVersion)
+    return Fail("unsupported version");
+  if (NumLayers == 0 || NumClasses < 2)
+    return Fail("bad model shape");
+
+  auto M = std::make_unique<DLRegAllocModel>();
+  M->SeqLen = SeqLen;
+  M->NumClasses = NumClasses;
+  M->Layers.resize(NumLayers);
+  unsigned ExpectedIn = SeqLen;
+  for (LSTMLayer &L : M->Layers) {
+    uint32_t In, Hidden;
+    if (!R.readU32(In) || !R.readU32(Hidden))
+      return Fail("truncated header");
+    // Every layer reads the concatenated output of the one before it
+    if (In != ExpectedIn || Hidden == 0)
+      return Fail("bad model shape");
+    L.Fwd.In = L.Bwd.In = In;
+    L.Fwd.Hidden = L.Bwd.Hidden = Hidden;
+    ExpectedIn = 2 * Hidden;
+  }
+
+  for (LSTMLayer &L : M->Layers) {
+    for (LSTMDirection *D : {&L.Fwd, &L.Bwd}) {
+      unsigned G = 4 * D->Hidden;
+      std::vector<float> BiasHH;
+      if (!R.readTransposed(D->WihT, G, D->In) ||
+          !R.readTransposed(D->WhhT, G, D->Hidden) ||
+          !R.readFloats(D->Bias, G) || !R.readFloats(BiasHH, G))
+        return Fail("truncated weights");
+      for (unsigned i = 0; i < G; i++)
+        D->Bias[i] += BiasHH[i];
+    }
+  }
+  if (!R.readTransposed(M->FcWT, NumClasses, ExpectedIn) ||
+      !R.readFloats(M->FcBias, NumClasses))
+    return Fail("truncated weights");
+  if (R.Pos != R.Data.size())
+    return Fail("trailing data");
+  return std::move(M);
+}
+
+// Run one direction of an LSTM layer over the whole sequence X (rows of D.In
+// floats) and write the hidden states into Out (rows of 2 * D.Hidden floats)
+// starting at column OutOffset. Gate order follows PyTorch: i, f, g, o.
+void DLRegAllocModel::runDirection(const LSTMDirection &D,
+                                   const std::vector<float> &X, bool Reverse,
+                                   std::vector<float> &Out,
+                                   unsigned OutOffset) const {
+  unsigned H = D.Hidden, G = 4 * H;
+  std::vector<float> Hs(H, 0.0f), Cs(H, 0.0f), Gates(G);
+  for (unsigned s = 0; s < SeqLen; s++) {
+    unsigned t = Reverse ? SeqLen - 1 - s : s;
+    std::copy(D.Bias.begin(), D.Bias.end(), Gates.begin());
+    gemvT(D.WihT.data(), &X[(size_t)t * D.In], D.In, G, Gates.data());
+    gemvT(D.WhhT.data(), Hs.data(), H, G, Gates.data());
+    for (unsigned j = 0; j < H; j++) {
+      float I = sigmoid(Gates[j]);
+      float F = sigmoid(Gates[H + j]);
+      float C = std::tanh(Gates[2 * H + j]);
+      float O = sigmoid(Gates[3 * H + j]);
+      Cs[j] = F * Cs[j] + I * C;
+      Hs[j] = O * std::tanh(Cs[j]);
+    }
+    std::copy(Hs.begin(), Hs.end(), &Out[(size_t)t * 2 * H + OutOffset]);
+  }
+}
+
+void DLRegAllocModel::predict(const SparseIG &G,
+                              std::vector<unsigned> &Colors) const {
+  unsigned N = std::min(G.size(), SeqLen);
+
+  // Same encoding as csr_to_adjacency in demo/utils.py: x[j][k] = 1 for an
+  // edge and x[j][j] = 1 for every node with at least one edge.
+  std::vector<float> X((size_t)SeqLen * SeqLen, 0.0f);
+  std::vector<bool> Valid(N, false);
+  for (unsigned i = 0; i < N; i++) {
+    for (unsigned j : G.neighbors(i)) {
+      if (j >= SeqLen)
+        break;
+      X[(size_t)i * SeqLen + j] = 1.0f;
+      Valid[i] = true;
+    }
+    if (Valid[i])
+      X[(size_t)i * SeqLen + i] = 1.0f;
+  }
+
+  for (const LSTMLayer &L : Layers) {
+    std::vector<float> Out((size_t)SeqLen * 2 * L.Fwd.Hidden);
+    runDirection(L.Fwd, X, /*Reverse=*/false, Out, 0);
+    runDirection(L.Bwd, X, /*Reverse=*/true, Out, L.Fwd.Hidden);
+    X.swap(Out);
+  }
+
+  // Linear head, only for rows that are real nodes. Class 0 is the padding
+  // label, so the argmax runs over the real colors.
+  unsigned In = 2 * Layers.back().Fwd.Hidden;
+  Colors.assign(G.size(), 0);
+  std::vector<float> Logits(NumClasses);
+  unsigned MaxColor = 0;
+  for (unsigned i = 0; i < N; i++) {
+    if (!Valid[i])
+      continue;
+    std::copy(FcBias.begin(), FcBias.end(), Logits.begin());
+    gemvT(FcWT.data(), &X[(size_t)i * In], In, NumClasses, Logits.data());
+    Colors[i] = std::max_element(Logits.begin() + 1, Logits.end()) -
+                Logits.begin();
+    MaxColor = std::max(MaxColor, Colors[i]);
+  }
+
+  // Repair edges whose ends got the same color: reuse a color that no
+  // neighbor of one end has, otherwise open a new color.
+  auto FreeFor = [&](unsigned V, unsigned C) {
+    for (unsigned Z : G.neighbors(V))
+      if (Z < N && Colors[Z] == C)
+        return false;
+    return true;
+  };
+  for (unsigned j = 0; j < N; j++) {
+    for (unsigned k : G.neighbors(j)) {
+      if (k >= j)
+        break;
+      if (!Colors[j] || Colors[j] != Colors[k])
+        continue;
+      bool Fixed = false;
+      for (unsigned C = 1; C <= MaxColor && !Fixed; C++) {
+        if (FreeFor(j, C)) {
+          Colors[j] = C;
+          Fixed = true;
+        } else if (FreeFor(k, C)) {
+          Colors[k] = C;
+          Fixed = true;
+        }
+      }
+      if (!Fixed)
+        Colors[k] = ++MaxColor;
+    }
+  }
+}
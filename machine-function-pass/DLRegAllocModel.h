@@ -0,0 +1,59 @@
+// In-process inference for the DLRegAlloc model (demo/model.py), used by
+// RegAlloc.cpp. Put this file and DLRegAllocModel.cpp under
+// "llvm-project/llvm/lib/CodeGen/".
+
+#ifndef LLVM_LIB_CODEGEN_DLREGALLOCMODEL_H
+#define LLVM_LIB_CODEGEN_DLREGALLOCMODEL_H
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/CodeGen/InterferenceGraph.h"
+#include "llvm/Support/Error.h"
+#include <memory>
+#include <vector>
+
+namespace llvm {
+
+// Stacked bidirectional LSTM followed by a linear head, evaluated on the
+// adjacency matrix of an interference graph. Weights come from the file
+// written by demo/export_model.py:
+//   magic "DLRA", version, sequence length, number of classes, layer count L,
+//   (input size, hidden size) for each layer,
+//   then float32 tensors in PyTorch layout, for each layer the forward and
+//   then the reverse direction: weight_ih, weight_hh, bias_ih, bias_hh,
+//   and finally fc.weight, fc.bias.
+// All fields are little-endian.
+class DLRegAllocModel {
+  struct LSTMDirection {
+    unsigned In = 0, Hidden = 0;
+    std::vector<float> WihT; // In x 4*Hidden, weight_ih transposed
+    std::vector<float> WhhT; // Hidden x 4*Hidden, weight_hh transposed
+    std::vector<float> Bias; // bias_ih + bias_hh
+  };
+  struct LSTMLayer {
+    LSTMDirection Fwd, Bwd;
+  };
+
+  unsigned SeqLen = 0, NumClasses = 0;
+  std::vector<LSTMLayer> Layers;
+  std::vector<float> FcWT; // In x NumClasses, fc.weight transposed
+  std::vector<float> FcBias;
+
+  void runDirection(const LSTMDirection &D, const std::vector<float> &X,
+                    bool Reverse, std::vector<float> &Out,
+                    unsigned OutOffset) const;
+
+public:
+  static Expected<std::unique_ptr<DLRegAllocModel>> load(StringRef Path);
+
+  unsigned seqLen() const { return SeqLen; }
+
+  // Predict a color for every node among the first seqLen() nodes of G that
+  // has an edge there, then repair conflicting edges the same way as
+  // post_process_correction in demo/utils.py. Colors[i] is 0 for nodes the
+  // model does not see.
+  void predict(const SparseIG &G, std::vector<unsigned> &Colors) const;
+};
+
+} // end namespace llvm
+
+#endif // LLVM_LIB_CODEGEN_DLREGALLOCMODEL_H
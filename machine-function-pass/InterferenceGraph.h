@@ -0,0 +1,686 @@
+// Interference graph types shared by X86IGGenerator.cpp and RegAlloc.cpp.
+// Put this file under "llvm-project/llvm/include/llvm/CodeGen/InterferenceGraph.h".
+
+#ifndef LLVM_CODEGEN_INTERFERENCEGRAPH_H
+#define LLVM_CODEGEN_INTERFERENCEGRAPH_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/IntEqClasses.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/CodeGen/LiveInterval.h"
+#include "llvm/CodeGen/LiveIntervals.h"
+#include "llvm/CodeGen/MachineRegisterInfo.h"
+#include "llvm/CodeGen/Register.h"
+#include "llvm/CodeGen/SlotIndexes.h"
+#include "llvm/CodeGen/TargetRegisterInfo.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/EndianStream.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace llvm {
+
+// Interference graph in compressed sparse-row form. The neighbors of node i
+// are Neighbors[Offsets[i] .. Offsets[i + 1]), sorted in ascending order.
+struct SparseIG {
+  std::vector<unsigned> Offsets;
+  std::vector<unsigned> Neighbors;
+
+  unsigned size() const { return Offsets.empty() ? 0 : Offsets.size() - 1; }
+  unsigned numEdges() const { return Neighbors.size() / 2; }
+  unsigned degree(unsigned i) const { return Offsets[i + 1] - Offsets[i]; }
+  ArrayRef<unsigned> neighbors(unsigned i) const {
+    return ArrayRef<unsigned>(Neighbors).slice(Offsets[i], degree(i));
+  }
+  bool hasEdge(unsigned i, unsigned j) const {
+    return std::binary_search(Neighbors.begin() + Offsets[i],
+                              Neighbors.begin() + Offsets[i + 1], j);
+  }
+  void clear() {
+    Offsets.clear();
+    Neighbors.clear();
+  }
+};
+
+// One live segment of a virtual register, tagged with its graph node.
+struct LiveSeg {
+  SlotIndex Start, End;
+  unsigned Node;
+};
+
+// Build the interference graph of Regs (node i is Regs[i]) by sorting every
+// live segment by its start index and sweeping once. A segment interferes
+// exactly with the segments still active when it starts, so only real
+// overlaps are visited: O(S log S + E) time and O(E) memory.
+inline SparseIG buildSparseIG(const LiveIntervals &LIS, ArrayRef<Register> Regs) {
+  std::vector<LiveSeg> Segments;
+  for (unsigned i = 0; i < Regs.size(); i++) {
+    Register Reg = Regs[i];
+    if (Reg.isPhysical() || !LIS.hasInterval(Reg))
+      continue;
+    for (const LiveRange::Segment &S : LIS.getInterval(Reg))
+      Segments.push_back({S.start, S.end, i});
+  }
+  llvm::sort(Segments, [](const LiveSeg &A, const LiveSeg &B) {
+    return A.Start < B.Start;
+  });
+
+  std::vector<std::pair<unsigned, unsigned>> Edges;
+  std::vector<const LiveSeg *> Active;
+  for (const LiveSeg &S : Segments) {
+    // Segments are half-open, so anything ending at S.Start is retired.
+    unsigned Keep = 0;
+    for (const LiveSeg *A : Active) {
+      if (A->End <= S.Start)
+        continue;
+      Active[Keep++] = A;
+      if (A->Node != S.Node) {
+        Edges.push_back({A->Node, S.Node});
+        Edges.push_back({S.Node, A->Node});
+      }
+    }
+    Active.resize(Keep);
+    Active.push_back(&S);
+  }
+
+  // Two counting-sort passes (by target, then by source) leave every row
+  // sorted, so duplicate edges from multi-segment intervals are adjacent.
+  unsigned N = Regs.size();
+  std::vector<unsigned> Count(N + 1, 0);
+  std::vector<std::pair<unsigned, unsigned>> ByTarget(Edges.size());
+  for (auto &E : Edges)
+    Count[E.second + 1]++;
+  for (unsigned i = 0; i < N; i++)
+    Count[i + 1] += Count[i];
+  for (auto &E : Edges)
+    ByTarget[Count[E.second]++] = E;
+
+  std::vector<unsigned> RowStart(N + 1, 0);
+  for (auto &E : ByTarget)
+    RowStart[E.first + 1]++;
+  for (unsigned i = 0; i < N; i++)
+    RowStart[i + 1] += RowStart[i];
+  std::vector<unsigned> Sorted(ByTarget.size());
+  std::vector<unsigned> Fill(RowStart.begin(), RowStart.end() - 1);
+  for (auto &E : ByTarget)
+    Sorted[Fill[E.first]++] = E.second;
+
+  SparseIG G;
+  G.Offsets.assign(N + 1, 0);
+  G.Neighbors.reserve(Sorted.size());
+  for (unsigned i = 0; i < N; i++) {
+    for (unsigned e = RowStart[i]; e < RowStart[i + 1]; e++) {
+      if (e != RowStart[i] && Sorted[e] == Sorted[e - 1])
+        continue;
+      G.Neighbors.push_back(Sorted[e]);
+    }
+    G.Offsets[i + 1] = G.Neighbors.size();
+  }
+  return G;
+}
+
+// Color G optimally if it is chordal, as interference graphs of strict SSA
+// programs are. Maximum cardinality search visits the nodes so that the
+// reverse order is a perfect elimination order exactly when G is chordal,
+// which holds if the earlier-visited neighbors of every node, minus the last
+// visited one, are neighbors of that last one. Greedy coloring in visiting
+// order then uses as many colors as the largest clique. Colors[i] starts at 1.
+// The neighbor test is deferred to the last visited node, which marks its own
+// neighbors once, so the whole function runs in O(N + E).
+// Returns false, leaving Colors unspecified, if G is not chordal.
+inline bool colorChordal(const SparseIG &G, std::vector<unsigned> &Colors) {
+  unsigned N = G.size();
+  std::vector<unsigned> Order, Weight(N, 0), Pos(N, ~0u);
+  // Buckets[w] holds nodes pushed with weight w; stale entries are skipped
+  std::vector<std::vector<unsigned>> Buckets(N + 1);
+  Buckets[0].reserve(N);
+  for (unsigned i = N; i-- > 0;)
+    Buckets[0].push_back(i);
+  unsigned Max = 0;
+  Order.reserve(N);
+  while (Order.size() < N) {
+    while (Buckets[Max].empty())
+      Max--;
+    unsigned v = Buckets[Max].back();
+    Buckets[Max].pop_back();
+    if (Pos[v] != ~0u || Weight[v] != Max)
+      continue;
+    Pos[v] = Order.size();
+    Order.push_back(v);
+    for (unsigned u : G.neighbors(v)) {
+      if (Pos[u] != ~0u)
+        continue;
+      Buckets[++Weight[u]].push_back(u);
+      Max = std::max(Max, Weight[u]);
+    }
+  }
+
+  Colors.assign(N, 0);
+  std::vector<unsigned> UsedBy(N + 2, ~0u);
+  // Deferred[w]: nodes that must be neighbors of w, the last visited
+  // neighbor of some later node
+  std::vector<std::vector<unsigned>> Deferred(N);
+  for (unsigned v : Order) {
+    unsigned Last = ~0u;
+    for (unsigned u : G.neighbors(v))
+      if (Pos[u] < Pos[v] && (Last == ~0u || Pos[u] > Pos[Last]))
+        Last = u;
+    for (unsigned u : G.neighbors(v))
+      if (Pos[u] < Pos[v] && u != Last)
+        Deferred[Last].push_back(u);
+    for (unsigned u : G.neighbors(v))
+      if (Pos[u] < Pos[v])
+        UsedBy[Colors[u]] = v;
+    unsigned C = 1;
+    while (UsedBy[C] == v)
+      C++;
+    Colors[v] = C;
+  }
+
+  std::vector<unsigned> Mark(N, ~0u);
+  for (unsigned w = 0; w < N; w++) {
+    if (Deferred[w].empty())
+      continue;
+    for (unsigned u : G.neighbors(w))
+      Mark[u] = w;
+    for (unsigned u : Deferred[w])
+      if (Mark[u] != w)
+        return false;
+  }
+  return true;
+}
+
+// Physical registers grouped into congruence classes: registers of the
+// allocatable classes that share a register unit, directly or through other
+// registers, end up in the same class. Register tuples (e.g. X86's K0_K1,
+// whose sub-register indices have no bit offset) do not join the classes of
+// their members, which never overlap each other, and each get a class of
+// their own, as does every register outside the allocatable classes. Rep
+// maps every register to the smallest register of its class and Members
+// lists each class by its representative. RegAlloc.cpp maps predicted colors
+// to these classes, and X86IGGenerator labels training graphs with them.
+struct CongruenceTable {
+  std::vector<unsigned> Rep;
+  std::vector<std::vector<unsigned>> Members;
+};
+
+// The classes only depend on the target, so each pass builds them once per
+// TargetRegisterInfo, next to computeClassPartitions, by a union-find over
+// register units.
+inline CongruenceTable buildCongruenceTable(const TargetRegisterInfo &TRI) {
+  unsigned NumRegs = TRI.getNumRegs();
+  BitVector Joins(NumRegs);
+  for (const TargetRegisterClass *RC : TRI.regclasses())
+    if (RC->isAllocatable())
+      for (MCPhysReg Reg : *RC)
+        Joins.set(Reg);
+  for (unsigned preg = 1; preg != NumRegs; ++preg)
+    for (MCSubRegIndexIterator S(MCRegister(preg), &TRI); S.isValid(); ++S)
+      if (TRI.getSubRegIdxOffset(S.getSubRegIndex()) == uint16_t(~0u)) {
+        Joins.reset(preg);
+        break;
+      }
+
+  std::vector<unsigned> Parent(TRI.getNumRegUnits());
+  for (unsigned u = 0; u != Parent.size(); ++u)
+    Parent[u] = u;
+  auto find = [&](unsigned u) {
+    while (Parent[u] != u)
+      u = Parent[u] = Parent[Parent[u]];
+    return u;
+  };
+  for (unsigned preg : Joins.set_bits()) {
+    MCRegUnitIterator Units(MCRegister(preg), &TRI);
+    if (!Units.isValid())
+      continue;
+    unsigned Root = find(*Units);
+    for (++Units; Units.isValid(); ++Units)
+      Parent[find(*Units)] = Root;
+  }
+
+  CongruenceTable Table;
+  Table.Rep.resize(NumRegs);
+  Table.Members.resize(NumRegs);
+  std::vector<unsigned> RootRep(Parent.size(), 0);
+  for (unsigned preg = 1; preg != NumRegs; ++preg) {
+    MCRegUnitIterator Units(MCRegister(preg), &TRI);
+    unsigned R = preg;
+    if (Joins.test(preg) && Units.isValid()) {
+      unsigned &Smallest = RootRep[find(*Units)];
+      if (!Smallest)
+        Smallest = preg;
+      R = Smallest;
+    }
+    Table.Rep[preg] = R;
+    Table.Members[R].push_back(preg);
+  }
+  return Table;
+}
+
+// Group the register classes of TRI so that classes in different groups share
+// no register unit, e.g. GR8..GR64 in one group and FR32..VR512 in another.
+// Vregs of different groups never compete for a register, so every group gets
+// its own interference graph. Only allocatable classes, the ones a vreg can
+// have, join groups; every other class is a group of its own. Returns the
+// group of each class, indexed by class ID and numbered from 0.
+inline std::vector<unsigned> computeClassPartitions(const TargetRegisterInfo &TRI) {
+  unsigned NumClasses = TRI.getNumRegClasses();
+  IntEqClasses Groups(NumClasses);
+  std::vector<int> UnitOwner(TRI.getNumRegUnits(), -1);
+  for (const TargetRegisterClass *RC : TRI.regclasses()) {
+    if (!RC->isAllocatable())
+      continue;
+    for (MCPhysReg Reg : *RC) {
+      for (MCRegUnitIterator Units(MCRegister(Reg), &TRI); Units.isValid(); ++Units) {
+        int &Owner = UnitOwner[*Units];
+        if (Owner < 0)
+          Owner = RC->getID();
+        else
+          Groups.join(Owner, RC->getID());
+      }
+    }
+  }
+  Groups.compress();
+  std::vector<unsigned> Partition(NumClasses);
+  for (unsigned i = 0; i < NumClasses; i++)
+    Partition[i] = Groups[i];
+  return Partition;
+}
+
+// Split Regs by the partition of their register class. Returns the positions
+// in Regs of the members of each partition, in order of first appearance.
+inline std::vector<std::vector<unsigned>>
+partitionRegs(const MachineRegisterInfo &MRI, ArrayRef<unsigned> ClassPartition,
+              ArrayRef<Register> Regs) {
+  std::vector<std::vector<unsigned>> Parts;
+  std::vector<int> PartOf(ClassPartition.size(), -1);
+  for (unsigned i = 0; i < Regs.size(); i++) {
+    int &P = PartOf[ClassPartition[MRI.getRegClass(Regs[i])->getID()]];
+    if (P < 0) {
+      P = Parts.size();
+      Parts.emplace_back();
+    }
+    Parts[P].push_back(i);
+  }
+  return Parts;
+}
+
+// Record name of partition P of function Function in the IGB stream
+inline std::string partitionRecordName(StringRef Function, unsigned P) {
+  return (Function + "#" + Twine(P)).str();
+}
+
+// Symmetric adjacency matrix with one row of 64-bit words per node. Neighbor
+// scans skip empty words and degrees are popcounts over a row, a loop the
+// vectorizer widens when the target has a vector popcount.
+// RegAlloc.cpp keeps its working graph in one (simplify, the coalescing
+// tests and the incremental updates between spill rounds). X86IGGenerator
+// writes CSR graphs and only assembles a matrix for its DEBUG dump.
+class IGBitMatrix {
+  unsigned N = 0;
+  unsigned WordsPerRow = 0;
+  std::vector<uint64_t> Bits;
+
+public:
+  // Resize to n nodes without any edges.
+  void reset(unsigned n) {
+    N = n;
+    WordsPerRow = (n + 63) / 64;
+    Bits.assign((size_t)N * WordsPerRow, 0);
+  }
+  void clear() { reset(0); }
+
+  // Grow to n nodes, keeping every edge.
+  void grow(unsigned n) {
+    if (n <= N)
+      return;
+    unsigned NewWords = (n + 63) / 64;
+    if (NewWords != WordsPerRow) {
+      std::vector<uint64_t> NewBits((size_t)n * NewWords, 0);
+      for (unsigned i = 0; i < N; i++)
+        std::copy(&Bits[(size_t)i * WordsPerRow],
+                  &Bits[(size_t)i * WordsPerRow] + WordsPerRow,
+                  &NewBits[(size_t)i * NewWords]);
+      Bits.swap(NewBits);
+      WordsPerRow = NewWords;
+    } else {
+      Bits.resize((size_t)n * WordsPerRow, 0);
+    }
+    N = n;
+  }
+
+  // Remove every edge of node i.
+  void isolate(unsigned i) {
+    forEachNeighbor(i, [&](unsigned j) {
+      Bits[(size_t)j * WordsPerRow + i / 64] &= ~(uint64_t(1) << (i % 64));
+    });
+    std::fill_n(&Bits[(size_t)i * WordsPerRow], WordsPerRow, 0);
+  }
+
+  unsigned size() const { return N; }
+  unsigned wordsPerRow() const { return WordsPerRow; }
+  ArrayRef<uint64_t> row(unsigned i) const {
+    return ArrayRef<uint64_t>(Bits).slice((size_t)i * WordsPerRow, WordsPerRow);
+  }
+
+  void addEdge(unsigned a, unsigned b) {
+    Bits[(size_t)a * WordsPerRow + b / 64] |= uint64_t(1) << (b % 64);
+    Bits[(size_t)b * WordsPerRow + a / 64] |= uint64_t(1) << (a % 64);
+  }
+  bool hasEdge(unsigned a, unsigned b) const {
+    return (Bits[(size_t)a * WordsPerRow + b / 64] >> (b % 64)) & 1;
+  }
+
+  // Add the edges of G, mapping its node i to NodeIds[i].
+  void addEdges(const SparseIG &G, ArrayRef<unsigned> NodeIds) {
+    for (unsigned i = 0; i < G.size(); i++)
+      for (unsigned j : G.neighbors(i))
+        if (i < j)
+          addEdge(NodeIds[i], NodeIds[j]);
+  }
+
+  unsigned degree(unsigned i) const {
+    const uint64_t *R = &Bits[(size_t)i * WordsPerRow];
+    unsigned D = 0;
+    for (unsigned w = 0; w < WordsPerRow; w++)
+      D += countPopulation(R[w]);
+    return D;
+  }
+
+  // Number of neighbors of i that are also set in Mask (wordsPerRow() words).
+  unsigned degreeMasked(unsigned i, ArrayRef<uint64_t> Mask) const {
+    const uint64_t *R = &Bits[(size_t)i * WordsPerRow];
+    unsigned D = 0;
+    for (unsigned w = 0; w < WordsPerRow; w++)
+      D += countPopulation(R[w] & Mask[w]);
+    return D;
+  }
+
+  // Call F(j) for every neighbor j of i in ascending order.
+  template <typename Fn> void forEachNeighbor(unsigned i, Fn F) const {
+    const uint64_t *R = &Bits[(size_t)i * WordsPerRow];
+    for (unsigned w = 0; w < WordsPerRow; w++) {
+      for (uint64_t Word = R[w]; Word; Word &= Word - 1)
+        F(w * 64 + countTrailingZeros(Word));
+    }
+  }
+};
+
+// Binary interference graph stream, one record per register class partition
+// of each machine function, named by partitionRecordName. Every field is a
+// little-endian uint32:
+//   stream header: magic "IGB1", version
+//   record:        size in bytes of the rest of the record,
+//                  name length L, name bytes padded to 4,
+//                  node count N, edge count E, VRegs[N],
+//                  Offsets[N + 1], Neighbors[2 * E]
+// VRegs maps node i to its virtual register index. Offsets and Neighbors are
+// the CSR arrays of SparseIG, so there is no limit on the number of nodes and
+// readers can use the arrays in place.
+const char IGBMagic[4] = {'I', 'G', 'B', '1'};
+const uint32_t IGBVersion = 3;
+const size_t IGBHeaderSize = 8;
+
+inline void writeIGStreamHeader(raw_ostream &OS) {
+  OS.write(IGBMagic, sizeof(IGBMagic));
+  support::endian::write<uint32_t>(OS, IGBVersion, support::little);
+}
+
+// Append one record. The record is assembled in memory first so the stream
+// sees a single write per function.
+inline void writeIGRecord(raw_ostream &OS, StringRef Name,
+                          ArrayRef<unsigned> VRegs, const SparseIG &G) {
+  SmallString<256> Record;
+  raw_svector_ostream RS(Record);
+  support::endian::Writer W(RS, support::little);
+  W.write<uint32_t>(Name.size());
+  RS << Name;
+  RS.write_zeros(alignTo(Name.size(), 4) - Name.size());
+  W.write<uint32_t>(VRegs.size());
+  W.write<uint32_t>(G.numEdges());
+  for (unsigned V : VRegs)
+    W.write<uint32_t>(V);
+  if (G.Offsets.empty())
+    W.write<uint32_t>(0);
+  for (unsigned O : G.Offsets)
+    W.write<uint32_t>(O);
+  for (unsigned V : G.Neighbors)
+    W.write<uint32_t>(V);
+  support::endian::write<uint32_t>(OS, Record.size(), support::little);
+  OS << Record;
+}
+
+// CSR graph whose arrays point into a buffer owned by someone else.
+struct IGGraphView {
+  uint32_t NumNodes = 0;
+  ArrayRef<support::ulittle32_t> Offsets;
+  ArrayRef<support::ulittle32_t> Neighbors;
+
+  unsigned size() const { return NumNodes; }
+  unsigned numEdges() const { return Neighbors.size() / 2; }
+  ArrayRef<support::ulittle32_t> neighbors(unsigned i) const {
+    return Neighbors.slice(Offsets[i], Offsets[i + 1] - Offsets[i]);
+  }
+};
+
+// One function's record inside a mapped stream.
+struct IGRecordView {
+  StringRef Name;
+  ArrayRef<support::ulittle32_t> VRegs;
+  IGGraphView Graph;
+};
+
+// Memory-mapped stream written by writeIGStreamHeader()/writeIGRecord().
+// Nothing is copied: the record views read the mapped file directly, after
+// checking that every size and index stays inside it.
+class IGStreamFile {
+  std::unique_ptr<MemoryBuffer> Buffer;
+  std::vector<IGRecordView> Records;
+
+  static Error fail(const char *Msg) {
+    return createStringError(inconvertibleErrorCode(),
+                             "malformed interference graph: %s", Msg);
+  }
+
+  static Error parseRecord(ArrayRef<support::ulittle32_t> Words,
+                           IGRecordView &R) {
+    if (Words.empty())
+      return fail("truncated record");
+    uint64_t NameLen = Words[0];
+    uint64_t NameWords = alignTo(NameLen, 4) / 4;
+    if (Words.size() < 3 + NameWords)
+      return fail("truncated record");
+    R.Name = StringRef(reinterpret_cast<const char *>(Words.data() + 1), NameLen);
+    Words = Words.drop_front(1 + NameWords);
+    uint64_t N = Words[0], E = Words[1];
+    if (Words.size() != 2 + N + (N + 1) + 2 * E)
+      return fail("record size mismatch");
+    IGGraphView &G = R.Graph;
+    R.VRegs = Words.slice(2, N);
+    G.NumNodes = N;
+    G.Offsets = Words.slice(2 + N, N + 1);
+    G.Neighbors = Words.slice(2 + N + N + 1, 2 * E);
+    if (G.Offsets[0] != 0 || G.Offsets[N] != 2 * E)
+      return fail("bad offsets");
+    for (uint64_t i = 0; i < N; i++)
+      if (G.Offsets[i] > G.Offsets[i + 1])
+        return fail("bad offsets");
+    for (uint32_t V : G.Neighbors)
+      if (V >= N)
+        return fail("neighbor out of range");
+    return Error::success();
+  }
+
+public:
+  static Expected<IGStreamFile> open(StringRef Path) {
+    auto BufOrErr = MemoryBuffer::getFile(Path, /*IsText=*/false,
+                                          /*RequiresNullTerminator=*/false);
+    if (!BufOrErr)
+      return errorCodeToError(BufOrErr.getError());
+    IGStreamFile F;
+    F.Buffer = std::move(*BufOrErr);
+    StringRef Data = F.Buffer->getBuffer();
+    if (Data.size() < IGBHeaderSize || Data.size() % 4 ||
+        Data.substr(0, sizeof(IGBMagic)) !=
+            StringRef(IGBMagic, sizeof(IGBMagic)))
+      return fail("bad magic");
+    auto Words = ArrayRef<support::ulittle32_t>(
+        reinterpret_cast<const support::ulittle32_t *>(Data.data()),
+        Data.size() / 4);
+    if (Words[1] != IGBVersion)
+      return fail("unsupported version");
+    Words = Words.drop_front(IGBHeaderSize / 4);
+    while (!Words.empty()) {
+      uint64_t Size = Words[0];
+      if (Size % 4 || Words.size() - 1 < Size / 4)
+        return fail("truncated record");
+      IGRecordView R;
+      if (Error E = parseRecord(Words.slice(1, Size / 4), R))
+        return std::move(E);
+      F.Records.push_back(R);
+      Words = Words.drop_front(1 + Size / 4);
+    }
+    return std::move(F);
+  }
+
+  ArrayRef<IGRecordView> records() const { return Records; }
+
+  // Record of the function called Name, or null.
+  const IGRecordView *lookup(StringRef Name) const {
+    for (const IGRecordView &R : Records)
+      if (R.Name == Name)
+        return &R;
+    return nullptr;
+  }
+};
+
+// Predicted colors written by demo/entry.py, or by the RegAlloc pass with
+// -color1-dump-predictions, one record per IGB record. Every
+// field is a little-endian uint32:
+//   header: magic "IGP1", version
+//   record: size in bytes of the rest of the record,
+//           name length L, name bytes padded to 4,
+//           node count N, edge count E, VRegs[N], Colors[N]
+// Name, N, E and VRegs repeat the IGB record the colors were predicted for,
+// so a reader can check that a record belongs to the graph it colors. Colors
+// are 0 for nodes the model does not see.
+const char IGPMagic[4] = {'I', 'G', 'P', '1'};
+const uint32_t IGPVersion = 1;
+
+inline void writeIGPredictionHeader(raw_ostream &OS) {
+  OS.write(IGPMagic, sizeof(IGPMagic));
+  support::endian::write<uint32_t>(OS, IGPVersion, support::little);
+}
+
+// Append the colors predicted for the graph G of VRegs as one record.
+inline void writeIGPredictionRecord(raw_ostream &OS, StringRef Name,
+                                    ArrayRef<unsigned> VRegs, const SparseIG &G,
+                                    ArrayRef<unsigned> Colors) {
+  assert(Colors.size() == VRegs.size() && "one color per node");
+  SmallString<256> Record;
+  raw_svector_ostream RS(Record);
+  support::endian::Writer W(RS, support::little);
+  W.write<uint32_t>(Name.size());
+  RS << Name;
+  RS.write_zeros(alignTo(Name.size(), 4) - Name.size());
+  W.write<uint32_t>(VRegs.size());
+  W.write<uint32_t>(G.numEdges());
+  for (unsigned V : VRegs)
+    W.write<uint32_t>(V);
+  for (unsigned C : Colors)
+    W.write<uint32_t>(C);
+  support::endian::write<uint32_t>(OS, Record.size(), support::little);
+  OS << Record;
+}
+
+// One record inside a mapped prediction file.
+struct IGPredictionView {
+  StringRef Name;
+  uint32_t NumEdges = 0;
+  ArrayRef<support::ulittle32_t> VRegs;
+  ArrayRef<support::ulittle32_t> Colors;
+};
+
+// Memory-mapped prediction file. Like IGStreamFile, records point into the
+// mapped file and every size is checked once when it is opened; lookups by
+// name go through a hash table.
+class IGPredictionFile {
+  std::unique_ptr<MemoryBuffer> Buffer;
+  std::vector<IGPredictionView> Records;
+  StringMap<unsigned> Index;
+
+  static Error fail(const Twine &Msg) {
+    return createStringError(inconvertibleErrorCode(),
+                             "malformed prediction file: " + Msg);
+  }
+
+public:
+  static Expected<IGPredictionFile> open(StringRef Path) {
+    auto BufOrErr = MemoryBuffer::getFile(Path, /*IsText=*/false,
+                                          /*RequiresNullTerminator=*/false);
+    if (!BufOrErr)
+      return errorCodeToError(BufOrErr.getError());
+    IGPredictionFile F;
+    F.Buffer = std::move(*BufOrErr);
+    StringRef Data = F.Buffer->getBuffer();
+    if (Data.size() < 8 || Data.size() % 4 ||
+        Data.substr(0, sizeof(IGPMagic)) !=
+            StringRef(IGPMagic, sizeof(IGPMagic)))
+      return fail("bad magic");
+    auto Words = ArrayRef<support::ulittle32_t>(
+        reinterpret_cast<const support::ulittle32_t *>(Data.data()),
+        Data.size() / 4);
+    if (Words[1] != IGPVersion)
+      return fail("unsupported version");
+    Words = Words.drop_front(2);
+    while (!Words.empty()) {
+      uint64_t Size = Words[0];
+      if (Size % 4 || Words.size() - 1 < Size / 4)
+        return fail("truncated record");
+      ArrayRef<support::ulittle32_t> R = Words.slice(1, Size / 4);
+      Words = Words.drop_front(1 + Size / 4);
+      if (R.empty())
+        return fail("truncated record");
+      uint64_t NameLen = R[0];
+      uint64_t NameWords = alignTo(NameLen, 4) / 4;
+      if (R.size() < 3 + NameWords)
+        return fail("truncated record");
+      IGPredictionView P;
+      P.Name = StringRef(reinterpret_cast<const char *>(R.data() + 1), NameLen);
+      R = R.drop_front(1 + NameWords);
+      uint64_t N = R[0];
+      if (R.size() != 2 + 2 * N)
+        return fail("record size mismatch for " + P.Name);
+      P.NumEdges = R[1];
+      P.VRegs = R.slice(2, N);
+      P.Colors = R.slice(2 + N, N);
+      if (!F.Index.try_emplace(P.Name, F.Records.size()).second)
+        return fail("duplicate record " + P.Name);
+      F.Records.push_back(P);
+    }
+    return std::move(F);
+  }
+
+  ArrayRef<IGPredictionView> records() const { return Records; }
+
+  // Record called Name, or null.
+  const IGPredictionView *lookup(StringRef Name) const {
+    auto It = Index.find(Name);
+    return It == Index.end() ? nullptr : &Records[It->second];
+  }
+};
+
+} // end namespace llvm
+
+#endif // LLVM_CODEGEN_INTERFERENCEGRAPH_H
@@ -2,11 +2,17 @@
 #include "llvm/CodeGen/VirtRegMap.h"
 #include "llvm/CodeGen/Spiller.h"
 #include "RegisterCoalescer.h"
+#include "SplitKit.h"
+#include "DLRegAllocCache.h"
+#include "DLRegAllocClient.h"
+#include "DLRegAllocModel.h"
 #include "llvm/CodeGen/LiveIntervals.h"
 #include "llvm/CodeGen/LiveRangeEdit.h"
 #include "llvm/CodeGen/LiveInterval.h"
+#include "llvm/CodeGen/InterferenceGraph.h"
 #include "llvm/CodeGen/LiveStacks.h"
 #include "llvm/CodeGen/MachineBlockFrequencyInfo.h"
+#include "llvm/CodeGen/MachineFrameInfo.h"
 #include "llvm/CodeGen/MachineFunctionPass.h"
 #include "llvm/CodeGen/MachineInstr.h"
 #include "llvm/CodeGen/MachineLoopInfo.h"
@@ -14,6 +20,7 @@
 #include "llvm/CodeGen/MachineFunction.h"
 #include "llvm/CodeGen/MachineDominators.h"
 #include "llvm/CodeGen/Passes.h"
+#include "llvm/CodeGen/PseudoSourceValue.h"
 #include "llvm/CodeGen/RegAllocRegistry.h"
 #include "llvm/CodeGen/TargetRegisterInfo.h"
 #include "llvm/CodeGen/TargetInstrInfo.h"
@@ -22,16 +29,21 @@
 #include "llvm/ADT/EquivalenceClasses.h"
 #include "llvm/ADT/BitVector.h"
 #include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/Statistic.h"
 #include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Compiler.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/Timer.h"
 #include <algorithm>
 #include <set>
 #include <map>
 #include <queue>
 #include <memory>
+#include <optional>
 #include <cmath>
-#include <fstream>
-#include <sstream>
 #include <vector>
 
 #define DEBUG_TYPE "regalloc"
@@ -39,23 +51,82 @@
 using namespace llvm;
 using namespace std;
 
+STATISTIC(NumCoalesced, "Number of copy-related vregs coalesced");
+STATISTIC(NumCopiesRemoved, "Number of copies removed by coalescing");
+STATISTIC(NumSpilled, "Number of vregs spilled");
+STATISTIC(NumLoopSplits, "Number of vregs split around a loop");
+STATISTIC(NumBlockSplits, "Number of vregs split into per-block intervals");
+STATISTIC(NumVRegs, "Number of vregs in interference graphs");
+STATISTIC(NumEdges, "Number of interference graph edges");
+STATISTIC(NumRounds, "Number of graph coloring rounds");
+STATISTIC(NumRebuilds, "Number of interference graphs rebuilt after incremental rounds");
+STATISTIC(NumCacheHits, "Number of partitions whose coloring came from -color1-cache");
+STATISTIC(NumChordal, "Number of chordal partitions colored without a prediction");
+STATISTIC(NumMatched, "Number of functions allocated by color matching");
+STATISTIC(NumFallbacks, "Number of functions that fell back to graph coloring");
+STATISTIC(NumRepairKept, "Number of predicted colors kept by local repair");
+STATISTIC(NumRepairRecolored, "Number of vregs recolored by local repair");
+STATISTIC(NumKempeSwaps, "Number of Kempe chain swaps during local repair");
+STATISTIC(NumSpillStores, "Number of spill stores after allocation");
+STATISTIC(NumReloads, "Number of reloads after allocation");
+STATISTIC(NumCopiesLeft, "Number of copies left between different registers");
+STATISTIC(NumCSRUsed, "Number of callee-saved registers used");
+
+static const char TimerGroupName[] = "color1";
+static const char TimerGroupDescription[] = "Graph Coloring Register Allocator";
+
 static RegisterRegAlloc
 GraphColorRegAlloc("color1", "graph coloring register allocator",
             createColorRegisterAllocator);
 
+static cl::opt<std::string> ColorModelPath(
+	"color1-model", cl::Hidden,
+	cl::desc("Predict colors in-process with the weights exported by "
+			 "demo/export_model.py instead of reading -color1-predictions"));
 
-namespace {
-	map<unsigned, set<unsigned> > InterferenceGraph;
-	map<unsigned, int> Degree;
-   	map<unsigned, bool> OnStack;
-	set<unsigned> Colored;
-	BitVector Allocatable;
+static cl::opt<std::string> ColorServerPath(
+	"color1-server", cl::Hidden,
+	cl::desc("Unix socket of demo/inference_server.py; ask it for colors "
+			 "instead of reading -color1-predictions"));
+
+static cl::opt<std::string> ColorPredictionsPath(
+	"color1-predictions", cl::init("model_output.igp"), cl::Hidden,
+	cl::desc("Colors predicted by demo/entry.py, used when neither "
+			 "-color1-model nor -color1-server is given"));
+
+static cl::opt<std::string> ColorCacheDir(
+	"color1-cache", cl::Hidden,
+	cl::desc("Directory of colorings predicted by -color1-model or "
+			 "-color1-server, keyed by model and graph; may be shared by "
+			 "parallel llc runs"));
 
+static cl::opt<std::string> ColorDumpPath(
+	"color1-dump-predictions", cl::Hidden,
+	cl::desc("Write the colors predicted for every partition to this file, "
+			 "in the format of -color1-predictions (see "
+			 "demo/check_model_parity.py)"));
+
+static cl::opt<std::string> ColorReportPath(
+	"color1-report", cl::Hidden,
+	cl::desc("Append one JSON object per function with the allocation "
+			 "counts to this file"));
+
+
+namespace {
 	class RegAllocGraphColoring : public MachineFunctionPass 
 	{
 		public:
 			static char ID;
 
+			/// Per-function working state. It lives in the pass instance, so
+			/// every code generation thread has its own copy.
+			IGBitMatrix InterferenceGraph;	// indexed by virtual register index
+			vector<unsigned> IGNodes;	// virtual register indices with a node
+			vector<int> Degree;
+			vector<bool> OnStack;
+			set<unsigned> Colored;
+			BitVector Allocatable;
+
 			LiveIntervals *LI;
 			MachineFunction *MF;
 			const TargetMachine *TM;
@@ -64,28 +135,91 @@ namespace {
   			const TargetInstrInfo *tii;
   			MachineRegisterInfo *mri;
 			std::unique_ptr<Spiller> VRegSpiller;
+			std::unique_ptr<SplitAnalysis> SA;
+			std::unique_ptr<SplitEditor> SE;
+			MachineLoopInfo *Loops;
+			MachineBlockFrequencyInfo *MBFI;
+			/// Intervals made by a split that must not be split again, so that
+			/// splitting always makes progress towards a spill
+			set<unsigned> NoSplit;
 			//  RenderMachineFunction *rmf;
 			/// Inst which is a def of an original reg and whose defs are already all
 			/// dead after remat is saved in DeadRemats. The deletion of such inst is
 			/// postponed till all the allocations are done, so its remat expr is
 			/// always available for the remat of all the siblings of the original reg.
 			SmallPtrSet<MachineInstr *, 32> DeadRemats;
+			/// Intervals created by SpillIt in the current round, as (new vreg
+			/// index, index of the vreg they were spilled from), and the spilled
+			/// vregs themselves. updateInterferenceGraph patches the graph with them.
+			vector<pair<unsigned, unsigned>> SpillProducts;
+			vector<unsigned> SpilledNodes;
+			/// Set for a round that starts with colored vregs it may not move.
+			/// An unspillable vreg that finds no register in such a round sets
+			/// RebuildGraph instead of being spilled.
+			bool EvictOnFailure = false;
+			bool RebuildGraph = false;
+			/// Copy coalescing state: the node each vreg index was merged into
+			/// (itself if none), the vregs merged into each representative, the
+			/// intersection of their allowed registers, and every virtual COPY
+			/// seen as (dst index, src index).
+			vector<unsigned> CoalescedInto;
+			map<unsigned, vector<unsigned>> CoalescedMembers;
+			map<unsigned, set<unsigned>> CoalescedAllowed;
+			vector<pair<unsigned, unsigned>> CopyPairs;
+			/// Register units of each physical register, the partition of
+			/// each register class (computeClassPartitions) and the register
+			/// congruence classes for the current target, the units taken by
+			/// colored neighbors of each node, and the registers each vreg may
+			/// use, computed once per function.
+			const TargetRegisterInfo *UnitMaskTRI = nullptr;
+			vector<BitVector> RegUnitMasks;
+			vector<unsigned> ClassPartition;
+			CongruenceTable Congruence;
+			vector<BitVector> ForbiddenUnits;
+			map<unsigned, set<unsigned>> PotentialRegsCache;
 
 			VirtRegMap *vrm;
 			LiveStacks *lss;
 			int k;
 
-			map<unsigned, unsigned> pa;
-			map<unsigned, unsigned> pb;
-			map<unsigned, unsigned> vis;
+			vector<unsigned> ColorToReg;	// matched class representative of each color
 			map<unsigned, set<unsigned>>AllocGraph;
-			unsigned dfn = 0, res = 0;
 
 			map<unsigned, unsigned>ColorResult;
 			std::map<unsigned, std::set<unsigned>> VRegAllowedMap;
-			map<unsigned, unsigned>UnionFind;
-			map<unsigned, set<unsigned>> CongruenceClass;
 			set<unsigned> BoundedNodes;
+			/// The partitions handle_color_result colored and their graphs,
+			/// kept to check the matched registers against every edge.
+			vector<vector<Register>> PartRegs;
+			vector<SparseIG> PartGraphs;
+			std::unique_ptr<DLRegAllocModel> Model;
+			bool ModelLoadFailed = false;
+			std::optional<DLRegAllocCache> Cache;
+			bool CacheOpenFailed = false;
+			/// -color1-predictions, mapped once and kept for the whole module.
+			std::optional<IGPredictionFile> Predictions;
+			bool PredictionsLoadFailed = false;
+
+			/// Counts for the -color1-report line of the current function, and
+			/// their sum over the module. The *Cost fields weight every
+			/// instruction with the frequency of its block relative to entry.
+			struct FunctionReport {
+				unsigned Functions = 0, Matched = 0, Chordal = 0, CacheHits = 0;
+				unsigned VRegs = 0, Edges = 0, Rounds = 0, Spills = 0, Splits = 0;
+				unsigned Coalesced = 0, CopiesRemoved = 0;
+				unsigned RepairKept = 0, RepairRecolored = 0;
+				unsigned SpillStores = 0, Reloads = 0, Copies = 0, CalleeSaved = 0;
+				double SpillStoreCost = 0, ReloadCost = 0, CopyCost = 0, CalleeSavedCost = 0;
+
+				void add(const FunctionReport &R);
+			} Report, ModuleReport;
+			std::unique_ptr<raw_fd_ostream> ReportStream;
+			std::unique_ptr<raw_fd_ostream> DumpStream;
+			void dumpPrediction(unsigned P, ArrayRef<Register> Regs, const SparseIG &Graph,
+								ArrayRef<unsigned> Colors);
+			void measureAllocation(const MachineBlockFrequencyInfo &MBFI);
+			void writeReport(StringRef Key, StringRef Name, const FunctionReport &R);
+			bool doFinalization(Module &M) override;
 			
 
 			RegAllocGraphColoring() : MachineFunctionPass(ID)
@@ -138,8 +272,23 @@ namespace {
 			set<unsigned> getSetofPotentialRegs(TargetRegisterClass trc,unsigned v_reg);
 			unsigned GetReg(set<unsigned> PotentialRegs, unsigned v_reg);
 			bool colorNode(unsigned v_reg);
-			bool allocateRegisters();
+			void computeRegUnitMasks();
+			vector<vector<Register>> partitionVRegs(ArrayRef<Register> Regs);
+			vector<vector<Register>> generatorPartitions();
+			bool allocateRegisters(const vector<unsigned> &Worklist);
+			vector<unsigned> updateInterferenceGraph();
+			void rebuildInterferenceGraph();
+			void coalesceCopies();
+			vector<unsigned> repairPrediction();
+			bool regFree(unsigned v, unsigned preg, const set<unsigned> &Skip = {});
+			bool recolor(unsigned v);
+			bool kempeSwap(unsigned v);
+			bool briggsTest(unsigned a, unsigned b, int K);
+			bool georgeTest(unsigned a, unsigned b, int K);
 			bool SpillIt(unsigned v_reg);
+			bool splitIt(unsigned v_reg, LiveRangeEdit &LRE);
+			float spillWeight(unsigned v);
+			int numAllowedRegs(unsigned v);
 			void addStackInterval(const LiveInterval*,MachineRegisterInfo *);
 			void dumpPass();
 			void postOptimization();
@@ -147,13 +296,11 @@ namespace {
 
 			// bi-graph matching
 			bool bigraphmatching();
-			bool dfs(unsigned v);
-			void handle_color_result();
+			unsigned matchColors();
+			bool handle_color_result();
+			bool predictColors(unsigned P, ArrayRef<Register> Regs, const SparseIG &Graph,
+							   vector<unsigned> &Colors);
 			void preprocess();
-			void join(unsigned a, unsigned b);
-			bool SameCongruenceClass(unsigned a, unsigned b);
-			unsigned find(unsigned x);
-			bool UnitOverlap(unsigned a, unsigned b);
 	};
 	char RegAllocGraphColoring::ID = 0;
 }
@@ -178,7 +325,8 @@ INITIALIZE_PASS_END(RegAllocGraphColoring, "regallocbasic", "Test Register Alloc
 void RegAllocGraphColoring::buildInterferenceGraph()
 {
 	int num=0;
-	errs()<<"Number of VirRegs is "<<mri->getNumVirtRegs()<<"\n";
+	LLVM_DEBUG(dbgs()<<"Number of VirRegs is "<<mri->getNumVirtRegs()<<"\n");
+	vector<Register> Regs;
 	for (unsigned i = 0, e = mri->getNumVirtRegs();i != e; ++i) {
 		Register ii = Register::index2VirtReg(i);
 		if (mri->reg_nodbg_empty(ii))
@@ -186,40 +334,390 @@ void RegAllocGraphColoring::buildInterferenceGraph()
         if (LI->hasInterval(ii)) {
 			if(ii.isPhysical()) //  just follow original framework eventhough it seems unnecessary here
 				continue;
-			const LiveInterval &li = LI->getInterval(ii);
 			num++;
 			unsigned ii_index = ii.virtRegIndex(); 
-			OnStack[ii_index] = false;    
-			InterferenceGraph[ii_index].insert(-1);
-			for (unsigned j = 0, e = mri->getNumVirtRegs();j != e; ++j) {
-				Register jj = Register::index2VirtReg(j);
-				if (mri->reg_nodbg_empty(jj))
-      				continue;
-        		if (LI->hasInterval(jj)) {
-					const LiveInterval &li2 = LI->getInterval(jj);
-					unsigned jj_index = jj.virtRegIndex();
-					if(jj_index == ii_index)
-						continue;
-					if(jj.isPhysical()) // same as before
-						continue;
-					if (li.overlaps(li2)) 
-					{
-						if(!InterferenceGraph[ii_index].count(jj_index))
-						{
-							InterferenceGraph[ii_index].insert(jj_index);
-							Degree[ii_index]++;
-						}
-						if(!InterferenceGraph[jj_index].count(ii_index))
-						{
-							InterferenceGraph[jj_index].insert(ii_index);
-							Degree[jj_index]++;
-						}
+			IGNodes.push_back(ii_index);
+			Regs.push_back(ii);
+		} 	
+	}
+	// Sweep the sorted live segments once instead of testing every pair, and
+	// only within a register class partition
+	InterferenceGraph.reset(mri->getNumVirtRegs());
+	unsigned Edges = 0;
+	for(const vector<Register> &Part : partitionVRegs(Regs)){
+		vector<unsigned> Nodes;
+		for(Register R : Part)
+			Nodes.push_back(R.virtRegIndex());
+		SparseIG Graph = buildSparseIG(*LI, Part);
+		InterferenceGraph.addEdges(Graph, Nodes);
+		Edges += Graph.numEdges();
+	}
+	NumVRegs += num;
+	NumEdges += Edges;
+	Report.VRegs = num;
+	Report.Edges = Edges;
+	Degree.assign(mri->getNumVirtRegs(), 0);
+	OnStack.assign(mri->getNumVirtRegs(), true);
+	LLVM_DEBUG(dbgs()<<"\nVirtual registers: "<<num);
+}
+
+//Patch the graph after a round of spilling: isolate every spilled node and
+//add the intervals LiveRangeEdit created for it. A new interval lies inside
+//the live range of the vreg it was spilled from, so only that vreg's
+//neighbors and the other new intervals need an overlap test. Returns the new
+//nodes, which are the only ones left to color; every other assignment stays.
+vector<unsigned> RegAllocGraphColoring::updateInterferenceGraph()
+{
+	unsigned NumVirtRegs = mri->getNumVirtRegs();
+	InterferenceGraph.grow(NumVirtRegs);
+	Degree.resize(NumVirtRegs, 0);
+	OnStack.resize(NumVirtRegs, true);
+	vector<bool> Spilled(NumVirtRegs, false);
+	for(unsigned v : SpilledNodes)
+		Spilled[v] = true;
+
+	vector<unsigned> Worklist;
+	vector<Register> NewRegs;
+	for(auto [index, from] : SpillProducts){
+		Register R = Register::index2VirtReg(index);
+		if (mri->reg_nodbg_empty(R) || !LI->hasInterval(R))
+			continue;
+		//a coalesced vreg has no edges of its own, its representative has them
+		if(from < CoalescedInto.size())
+			from = CoalescedInto[from];
+		const LiveInterval &li = LI->getInterval(R);
+		InterferenceGraph.forEachNeighbor(from, [&](unsigned n){
+			Register nn = Register::index2VirtReg(n);
+			if(Spilled[n] || !LI->hasInterval(nn))
+				return;
+			if(li.overlaps(LI->getInterval(nn)))
+				InterferenceGraph.addEdge(index, n);
+		});
+		Worklist.push_back(index);
+		NewRegs.push_back(R);
+	}
+	for(const vector<Register> &Part : partitionVRegs(NewRegs)){
+		vector<unsigned> Nodes;
+		for(Register R : Part)
+			Nodes.push_back(R.virtRegIndex());
+		InterferenceGraph.addEdges(buildSparseIG(*LI, Part), Nodes);
+	}
+
+	for(unsigned v : SpilledNodes)
+		InterferenceGraph.isolate(v);
+	llvm::erase_if(IGNodes, [&](unsigned v){ return Spilled[v]; });
+	IGNodes.insert(IGNodes.end(), Worklist.begin(), Worklist.end());
+	SpillProducts.clear();
+	SpilledNodes.clear();
+	LLVM_DEBUG(dbgs()<<"\nIncremental update: "<<Worklist.size()<<" new virtual registers");
+	return Worklist;
+}
+
+//Evict every assignment and build the graph again from the current intervals.
+//Incremental rounds never move a colored vreg, so a new interval may find no
+//register next to its fixed neighbors; a full round colors them all together.
+//Coalesced vregs become nodes of their own again.
+void RegAllocGraphColoring::rebuildInterferenceGraph()
+{
+	++NumRebuilds;
+	vrm->clearAllVirt();
+	InterferenceGraph.clear( );
+	IGNodes.clear( );
+	Colored.clear();
+	ForbiddenUnits.clear();
+	SpillProducts.clear();
+	SpilledNodes.clear();
+	CoalescedInto.clear();
+	CoalescedMembers.clear();
+	CoalescedAllowed.clear();
+	CopyPairs.clear();
+	RebuildGraph = false;
+	buildInterferenceGraph();
+}
+
+//True if no colored neighbor of v, other than the ones in Skip, holds a
+//register sharing a unit with preg.
+bool RegAllocGraphColoring::regFree(unsigned v, unsigned preg, const set<unsigned> &Skip)
+{
+	bool Free = true;
+	InterferenceGraph.forEachNeighbor(v, [&](unsigned n){
+		if(Free && Colored.count(n) && !Skip.count(n) &&
+		   RegUnitMasks[vrm->getPhys(n)].anyCommon(RegUnitMasks[preg]))
+			Free = false;
+	});
+	return Free;
+}
+
+//Give v any allowed register that none of its colored neighbors overlaps.
+bool RegAllocGraphColoring::recolor(unsigned v)
+{
+	for(unsigned r : getSetofPotentialRegs(*mri->getRegClass(v), v))
+		if(compatible_class(*MF, v, r) && regFree(v, r)){
+			vrm->assignVirt2Phys(v, r);
+			Colored.insert(v);
+			return true;
+		}
+	return false;
+}
+
+//Free a register r1 for v by swapping r1 and r2 on a Kempe chain: the
+//connected part of the r1/r2-colored subgraph that holds v's r1 neighbors.
+//The swap only happens if v has no r2 neighbor on that chain, every chain
+//node allows its new register, and no neighbor outside the chain overlaps
+//it. Chains are capped so the repair stays local.
+bool RegAllocGraphColoring::kempeSwap(unsigned v)
+{
+	const unsigned MaxChain = 64;
+	const set<unsigned> &Allowed = getSetofPotentialRegs(*mri->getRegClass(v), v);
+	for(unsigned r1 : Allowed){
+		if(!compatible_class(*MF, v, r1))
+			continue;
+		//only neighbors holding exactly r1 can be moved away from it
+		vector<unsigned> Blocking;
+		bool Movable = true;
+		InterferenceGraph.forEachNeighbor(v, [&](unsigned n){
+			if(!Colored.count(n) || !RegUnitMasks[vrm->getPhys(n)].anyCommon(RegUnitMasks[r1]))
+				return;
+			if(vrm->getPhys(n) == r1)
+				Blocking.push_back(n);
+			else
+				Movable = false;
+		});
+		if(!Movable || Blocking.empty())
+			continue;
+
+		for(unsigned r2 : Allowed){
+			if(r2 == r1 || RegUnitMasks[r1].anyCommon(RegUnitMasks[r2]))
+				continue;
+			auto other = [&](unsigned r){ return r == r1 ? r2 : r1; };
+			set<unsigned> Chain(Blocking.begin(), Blocking.end());
+			vector<unsigned> Queue(Blocking.begin(), Blocking.end());
+			bool Valid = true;
+			for(size_t q = 0; Valid && q < Queue.size(); q++)
+				InterferenceGraph.forEachNeighbor(Queue[q], [&](unsigned n){
+					if(!Valid || Chain.count(n) || !Colored.count(n))
+						return;
+					unsigned p = vrm->getPhys(n);
+					if(p != r1 && p != r2)
+						return;
+					if(n == v || Chain.size() == MaxChain){
+						Valid = false;
+						return;
 					}
+					Chain.insert(n);
+					Queue.push_back(n);
+				});
+			if(!Valid)
+				continue;
+			//an r2 neighbor of v on the chain would take r1 after the swap
+			InterferenceGraph.forEachNeighbor(v, [&](unsigned n){
+				if(Chain.count(n) && vrm->getPhys(n) == r2)
+					Valid = false;
+			});
+			for(auto It = Chain.begin(); Valid && It != Chain.end(); ++It){
+				unsigned r = other(vrm->getPhys(*It));
+				Valid = getSetofPotentialRegs(*mri->getRegClass(*It), *It).count(r) &&
+						compatible_class(*MF, *It, r) && regFree(*It, r, Chain);
+			}
+			if(!Valid)
+				continue;
+
+			for(unsigned n : Chain){
+				unsigned r = other(vrm->getPhys(n));
+				vrm->clearVirt(n);
+				vrm->assignVirt2Phys(n, r);
+			}
+			vrm->assignVirt2Phys(v, r1);
+			Colored.insert(v);
+			++NumKempeSwaps;
+			return true;
+		}
+	}
+	return false;
+}
+
+//Repair a prediction bigraphmatching rejected instead of dropping it. Every
+//vreg whose color was matched to a register class takes an allowed register
+//of that class unless a neighbor already holds an overlapping one, so only
+//one end of each conflicting edge (and the vregs the model left out) needs
+//work. Those are recolored with any free register, or with one freed by a
+//Kempe chain swap. Returns the vregs still uncolored; the caller colors them
+//like any other worklist and spills only if that fails too.
+vector<unsigned> RegAllocGraphColoring::repairPrediction()
+{
+	if(ColorToReg.empty())
+		matchColors();
+	vector<unsigned> Conflicts;
+	for(unsigned v : IGNodes){
+		unsigned Reg = 0;
+		auto Predicted = ColorResult.find(v);
+		if(Predicted != ColorResult.end() && Predicted->second < ColorToReg.size() &&
+		   ColorToReg[Predicted->second]){
+			const set<unsigned> &Allowed = getSetofPotentialRegs(*mri->getRegClass(v), v);
+			for(unsigned r : Congruence.Members[ColorToReg[Predicted->second]])
+				if(Allowed.count(r) && compatible_class(*MF, v, r)){
+					Reg = r;
+					break;
 				}
+		}
+		if(Reg && regFree(v, Reg)){
+			vrm->assignVirt2Phys(v, Reg);
+			Colored.insert(v);
+			++NumRepairKept;
+			Report.RepairKept++;
+		}
+		else
+			Conflicts.push_back(v);
+	}
+
+	vector<unsigned> Left;
+	for(unsigned v : Conflicts){
+		if(recolor(v) || kempeSwap(v)){
+			++NumRepairRecolored;
+			Report.RepairRecolored++;
+		}
+		else
+			Left.push_back(v);
+	}
+	LLVM_DEBUG(dbgs()<<"\nRepair kept "<<Report.RepairKept<<", recolored "
+					 <<Report.RepairRecolored<<", left "<<Left.size());
+	return Left;
+}
+
+//Briggs test: merging b into a is safe if the merged node has fewer than K
+//neighbors of significant degree. A neighbor of both loses one edge.
+bool RegAllocGraphColoring::briggsTest(unsigned a, unsigned b, int K)
+{
+	int Significant = 0;
+	auto count = [&](unsigned n){
+		int d = InterferenceGraph.degree(n);
+		if(InterferenceGraph.hasEdge(n, a) && InterferenceGraph.hasEdge(n, b))
+			d--;
+		if(d >= K)
+			Significant++;
+	};
+	InterferenceGraph.forEachNeighbor(a, count);
+	InterferenceGraph.forEachNeighbor(b, [&](unsigned n){
+		if(!InterferenceGraph.hasEdge(n, a))
+			count(n);
+	});
+	return Significant < K;
+}
+
+//George test: merging b into a is safe if every neighbor of b already
+//interferes with a or has insignificant degree.
+bool RegAllocGraphColoring::georgeTest(unsigned a, unsigned b, int K)
+{
+	bool Safe = true;
+	InterferenceGraph.forEachNeighbor(b, [&](unsigned n){
+		if(!InterferenceGraph.hasEdge(n, a) && InterferenceGraph.degree(n) >= K)
+			Safe = false;
+	});
+	return Safe;
+}
+
+//Conservative copy coalescing. A COPY between two non-interfering vregs of
+//the same class is merged when the Briggs or George test shows the merged
+//node stays colorable with the registers both of them allow; merging repeats
+//until nothing changes, since every merge can enable another. The merged
+//vregs get the representative's register, which turns their copies into
+//identity copies that VirtRegRewriter deletes.
+void RegAllocGraphColoring::coalesceCopies()
+{
+	unsigned NumVirtRegs = mri->getNumVirtRegs();
+	CoalescedInto.resize(NumVirtRegs);
+	for(unsigned i = 0; i != NumVirtRegs; ++i)
+		CoalescedInto[i] = i;
+	vector<bool> HasNode(NumVirtRegs, false);
+	for(unsigned v : IGNodes)
+		HasNode[v] = true;
+
+	for(MachineBasicBlock &MBB : *MF)
+		for(MachineInstr &MI : MBB){
+			if(!MI.isCopy())
+				continue;
+			const MachineOperand &Dst = MI.getOperand(0), &Src = MI.getOperand(1);
+			if(Dst.getSubReg() || Src.getSubReg() ||
+			   !Dst.getReg().isVirtual() || !Src.getReg().isVirtual() ||
+			   mri->getRegClass(Dst.getReg()) != mri->getRegClass(Src.getReg()))
+				continue;
+			unsigned d = Dst.getReg().virtRegIndex(), s = Src.getReg().virtRegIndex();
+			if(d != s && HasNode[d] && HasNode[s])
+				CopyPairs.push_back({d, s});
+		}
+
+	map<unsigned, set<unsigned>> Allowed;
+	auto allowed = [&](unsigned v) -> const set<unsigned> & {
+		auto It = Allowed.find(v);
+		if(It == Allowed.end())
+			It = Allowed.emplace(v, getSetofPotentialRegs(*mri->getRegClass(v), v)).first;
+		return It->second;
+	};
+
+	bool Changed = true;
+	while(Changed){
+		Changed = false;
+		for(auto [d, s] : CopyPairs){
+			unsigned a = CoalescedInto[d], b = CoalescedInto[s];
+			if(a == b || InterferenceGraph.hasEdge(a, b))
+				continue;
+			set<unsigned> Both;
+			const set<unsigned> &A = allowed(a), &B = allowed(b);
+			set_intersection(A.begin(), A.end(), B.begin(), B.end(),
+							 inserter(Both, Both.begin()));
+			int K = Both.size();
+			if(!K)
+				continue;
+			if(georgeTest(b, a, K))
+				swap(a, b);
+			else if(!briggsTest(a, b, K) && !georgeTest(a, b, K))
+				continue;
+
+			//merge b into a
+			InterferenceGraph.forEachNeighbor(b, [&](unsigned n){
+				InterferenceGraph.addEdge(a, n);
+			});
+			InterferenceGraph.isolate(b);
+			vector<unsigned> &Members = CoalescedMembers[a];
+			Members.push_back(b);
+			for(unsigned m : CoalescedMembers[b]){
+				CoalescedInto[m] = a;
+				Members.push_back(m);
 			}
-		} 	
+			CoalescedInto[b] = a;
+			CoalescedMembers.erase(b);
+			CoalescedAllowed.erase(b);
+			Allowed[a] = CoalescedAllowed[a] = std::move(Both);
+			++NumCoalesced;
+			Report.Coalesced++;
+			Changed = true;
+		}
 	}
-	errs( )<<"\nVirtual registers: "<<num;
+	llvm::erase_if(IGNodes, [&](unsigned v){ return CoalescedInto[v] != v; });
+	LLVM_DEBUG(dbgs()<<"\nCoalesced "<<CoalescedMembers.size()<<" copy-related groups");
+}
+
+//Spill weight of a node, including every vreg coalesced into it.
+//calculateSpillWeightsAndHints already scales each use and def by the
+//MachineBlockFrequencyInfo frequency of its block, so values in hot loops
+//are the expensive ones to spill. Unspillable intervals weigh infinity.
+float RegAllocGraphColoring::spillWeight(unsigned v)
+{
+	float W = LI->getInterval(v).weight();
+	auto Merged = CoalescedMembers.find(v);
+	if(Merged != CoalescedMembers.end())
+		for(unsigned m : Merged->second)
+			W += LI->getInterval(m).weight();
+	return W;
+}
+
+//Number of registers a node may be assigned, i.e. its k.
+int RegAllocGraphColoring::numAllowedRegs(unsigned v)
+{
+	auto Merged = CoalescedAllowed.find(v);
+	if(Merged != CoalescedAllowed.end())
+		return Merged->second.size();
+	return getSetofPotentialRegs(*mri->getRegClass(v), v).size();
 }
 
 //This function is used to check the compatibility of virtual register with the physical reg.
@@ -234,37 +732,64 @@ bool RegAllocGraphColoring::compatible_class(MachineFunction & mf, unsigned v_re
 }
 
 //check if aliases are empty
+//Overlap with fixed register units is already excluded by
+//getSetofPotentialRegs, so only the units of colored neighbors are left.
 bool RegAllocGraphColoring::aliasCheck(unsigned preg, unsigned vreg)
 {
-	//FIXME: Checkout correctness for iter over alias
-	
-	MCRegister PReg(preg);
-	LiveInterval &VRegLI = LI->getInterval(vreg);
-
-	// vregLI overlaps fixed regunit interference.
-	for (MCRegUnitIterator Units(PReg, TRI); Units.isValid(); ++Units) {
-		// make sure not interfere with original phy reg. maybe unnecessary
-		if (VRegLI.overlaps(LI->getRegUnit(*Units))) {
-			return false;
-		}
-		for(set<unsigned>::iterator ii = InterferenceGraph[vreg].begin();
-				ii != InterferenceGraph[vreg].end(); ii++){
-			if(Colored.count( *ii )){
-				MCRegister temp_PReg = vrm->getPhys(*ii);
-				for (MCRegUnitIterator Units2(temp_PReg, TRI); Units2.isValid(); ++Units2){
-					// if two adjacent nodes have common unit, then fail check
-					if(*Units == *Units2) return false;
-				}
-			}
-		}
+	return !ForbiddenUnits[vreg].anyCommon(RegUnitMasks[preg]);
+}
+
+//Fill RegUnitMasks for the current target. It only depends on the target,
+//so it is rebuilt only when the register info changes.
+void RegAllocGraphColoring::computeRegUnitMasks()
+{
+	if(UnitMaskTRI == TRI)
+		return;
+	UnitMaskTRI = TRI;
+	RegUnitMasks.assign(TRI->getNumRegs(), BitVector(TRI->getNumRegUnits()));
+	for(unsigned preg = 1, e = TRI->getNumRegs(); preg != e; ++preg)
+		for (MCRegUnitIterator Units(MCRegister(preg), TRI); Units.isValid(); ++Units)
+			RegUnitMasks[preg].set(*Units);
+	ClassPartition = computeClassPartitions(*TRI);
+	Congruence = buildCongruenceTable(*TRI);
+}
+
+//Split Regs into one list per register class partition, keeping their order
+vector<vector<Register>> RegAllocGraphColoring::partitionVRegs(ArrayRef<Register> Regs)
+{
+	vector<vector<Register>> Parts;
+	for(const vector<unsigned> &Part : partitionRegs(*mri, ClassPartition, Regs)){
+		Parts.emplace_back();
+		for(unsigned n : Part)
+			Parts.back().push_back(Regs[n]);
 	}
-	return true;
+	return Parts;
+}
+
+//The vregs of the graphs X86IGGenerator writes for MF, in the same node order
+//and partition order as its records
+vector<vector<Register>> RegAllocGraphColoring::generatorPartitions()
+{
+	vector<Register> Regs;
+	for (unsigned i = 0, e = mri->getNumVirtRegs();i != e; ++i) {
+		Register ii = Register::index2VirtReg(i);
+		if (mri->getVRegDef(ii) == nullptr || mri->reg_nodbg_empty(ii))
+			continue;
+		Regs.push_back(ii);
+	}
+	return partitionVRegs(Regs);
 }
 
 //return the set of potential register for a virtual register
 set<unsigned> RegAllocGraphColoring::getSetofPotentialRegs(TargetRegisterClass trc,unsigned v_reg)
 {
-	set<unsigned> PhysicalRegisters;
+	auto Cached = PotentialRegsCache.find(v_reg);
+	if(Cached != PotentialRegsCache.end())
+	{
+		k = Cached->second.size();
+		return Cached->second;
+	}
+	set<unsigned> &PhysicalRegisters = PotentialRegsCache[v_reg];
 	// Compute an initial allowed set for the current vreg.
 	// Inference: RegAllocPBQP.cpp 623::648
 	std::vector<MCRegister> VRegAllowed;
@@ -331,51 +856,147 @@ bool RegAllocGraphColoring::SpillIt(unsigned VReg_index)
 	// TODO: Check corresponding RenderMachineFunction
 	SmallVector<Register, 8> NewIntervals;
 	Register VReg = Register::index2VirtReg(VReg_index);
+	NamedRegionTimer T("spill", "Spiller", TimerGroupName,
+					   TimerGroupDescription, TimePassesIsEnabled);
 	// FIXME: Do nothing for now
 	// VRegsToAlloc.erase(VReg);
 	LiveRangeEdit LRE(&(LI->getInterval(VReg)), NewIntervals, *MF, *LI, vrm,
 						nullptr, &DeadRemats);
-	VRegSpiller->spill(LRE);
-
-	// Copy any newly inserted live intervals into the list of regs to
-	// allocate.
-	// FIXME: Do nothing for now
-	/*
-	for (const Register &R : LRE) {
-		const LiveInterval &li = LI->getInterval(R);
-		assert(!li.empty() && "Empty spill range.");
-		//VRegsToAlloc.insert(li.reg());
+	// Split first so spill code lands in cold code only
+	if(!splitIt(VReg_index, LRE))
+	{
+		VRegSpiller->spill(LRE);
+		++NumSpilled;
+		Report.Spills++;
 	}
-	*/
+
+	// Remember the newly inserted live intervals so the next round only has
+	// to add them to the graph and color them.
+	SpilledNodes.push_back(VReg_index);
+	for (const Register &R : NewIntervals)
+		SpillProducts.push_back({R.virtRegIndex(), VReg_index});
 	return NewIntervals.empty();
 }
 
+//Split a vreg that did not get a register instead of spilling all of it.
+//If it is live into a loop that is hotter than its preheader and has uses
+//outside that loop, the part inside the loop becomes its own interval, entered
+//at the end of the preheader and left at the top of each exit, so a spill of
+//the rest puts no code in the loop. Otherwise, if it is used in several
+//blocks, each block with uses gets its own interval and the spillable rest
+//only covers the blocks in between. Returns false if nothing was split.
+bool RegAllocGraphColoring::splitIt(unsigned VReg_index, LiveRangeEdit &LRE)
+{
+	if(NoSplit.count(VReg_index))
+		return false;
+	const LiveInterval &VirtReg = LRE.getParent();
+	SA->analyze(&VirtReg);
+	ArrayRef<SplitAnalysis::BlockInfo> UseBlocks = SA->getUseBlocks();
+
+	MachineLoop *Best = nullptr;
+	BlockFrequency BestFreq;
+	for(const SplitAnalysis::BlockInfo &BI : UseBlocks){
+		MachineLoop *L = Loops->getLoopFor(BI.MBB);
+		if(!L || L == Best)
+			continue;
+		MachineBasicBlock *Preheader = L->getLoopPreheader();
+		if(!Preheader || !LI->isLiveInToMBB(VirtReg, L->getHeader()))
+			continue;
+		BlockFrequency Freq = MBFI->getBlockFreq(L->getHeader());
+		if(Freq <= MBFI->getBlockFreq(Preheader) || (Best && Freq <= BestFreq))
+			continue;
+		//nothing would be left outside the loop to spill
+		if(llvm::all_of(UseBlocks, [&](const SplitAnalysis::BlockInfo &U){
+			   return L->contains(U.MBB); }))
+			continue;
+		//the copy at the top of an exit must only be reached from the loop
+		SmallVector<MachineBasicBlock *, 4> Exits;
+		L->getUniqueExitBlocks(Exits);
+		if(!llvm::all_of(Exits, [&](MachineBasicBlock *Exit){
+			   return llvm::all_of(Exit->predecessors(), [&](MachineBasicBlock *P){
+				   return L->contains(P); }); }))
+			continue;
+		Best = L;
+		BestFreq = Freq;
+	}
+
+	SmallVector<unsigned, 8> IntvMap;
+	if(Best){
+		SE->reset(LRE);
+		SE->openIntv();
+		SE->enterIntvAtEnd(*Best->getLoopPreheader());
+		for(MachineBasicBlock *MBB : Best->blocks())
+			SE->useIntv(*MBB);
+		SmallVector<MachineBasicBlock *, 4> Exits;
+		Best->getUniqueExitBlocks(Exits);
+		for(MachineBasicBlock *Exit : Exits)
+			if(LI->isLiveInToMBB(VirtReg, Exit))
+				SE->leaveIntvAtTop(*Exit);
+		SE->finish(&IntvMap);
+		//the loop part is not split again, the rest may be around another loop
+		for(unsigned i = 0; i != LRE.size(); i++)
+			if(IntvMap[i])
+				NoSplit.insert(LRE.get(i).virtRegIndex());
+		++NumLoopSplits;
+		Report.Splits++;
+		LLVM_DEBUG(dbgs()<<"\nVreg : "<<VReg_index<<" ---> Split around loop "
+						 <<Best->getHeader()->getNumber());
+		return true;
+	}
+
+	if(UseBlocks.size() < 2)
+		return false;
+	SE->reset(LRE);
+	for(const SplitAnalysis::BlockInfo &BI : UseBlocks)
+		if(SA->shouldSplitSingleBlock(BI, true))
+			SE->splitSingleBlock(BI);
+	if(LRE.empty())
+		return false;
+	SE->finish(&IntvMap);
+	for(unsigned i = 0; i != LRE.size(); i++)
+		NoSplit.insert(LRE.get(i).virtRegIndex());
+	++NumBlockSplits;
+	Report.Splits++;
+	LLVM_DEBUG(dbgs()<<"\nVreg : "<<VReg_index<<" ---> Split per block");
+	return true;
+}
+
 //assigns physical to virtual register
 bool RegAllocGraphColoring::colorNode(unsigned v_reg)
 {
 	bool notspilled = true;
-	errs()<<"\nColoring Register  : "<<v_reg;
+	LLVM_DEBUG(dbgs()<<"\nColoring Register  : "<<v_reg);
 	unsigned p_reg = 0;
 	const TargetRegisterClass *trc = MF->getRegInfo().getRegClass(v_reg);
 	set<unsigned> PotentialRegs = getSetofPotentialRegs(*trc,v_reg);
-	errs()<<"\nPotential register count is "<<PotentialRegs.size();
-	for(set<unsigned>::iterator ii = InterferenceGraph[v_reg].begin( ) ;
-			ii != InterferenceGraph[v_reg].end( ); ii++)
-	{
-		if(Colored.count( *ii )){
-			PotentialRegs.erase(vrm->getPhys(*ii));	
-			errs()<<"\nInterfere with %"<<*ii;
+	//a coalesced node may only use registers every member allows
+	auto Merged = CoalescedAllowed.find(v_reg);
+	if(Merged != CoalescedAllowed.end())
+		for(auto It = PotentialRegs.begin(); It != PotentialRegs.end();)
+			It = Merged->second.count(*It) ? next(It) : PotentialRegs.erase(It);
+	LLVM_DEBUG(dbgs()<<"\nPotential register count is "<<PotentialRegs.size());
+	//the merged vregs are spilled separately if the node gets no register
+	auto spillNode = [&](unsigned v){
+		if(EvictOnFailure && !LI->getInterval(Register::index2VirtReg(v)).isSpillable()){
+			LLVM_DEBUG(dbgs()<<"\nVreg : "<<v<<" is unspillable, rebuilding the graph");
+			RebuildGraph = true;
+			return false;
 		}
-		if(PotentialRegs.empty( ))
-			break;
-
-	}
+		bool Done = SpillIt(v);
+		for(unsigned m : CoalescedMembers[v])
+			Done = SpillIt(m) && Done;
+		CoalescedMembers.erase(v);
+		return Done;
+	};
+	//drop registers sharing a unit with a colored neighbor
+	for(auto It = PotentialRegs.begin(); It != PotentialRegs.end();)
+		It = aliasCheck(*It, v_reg) ? next(It) : PotentialRegs.erase(It);
 	//There are no Potential Physical Registers Available
 	if(PotentialRegs.empty( ))
 	{
-		errs()<<"Empty potentialRegs\n";
-		notspilled = SpillIt(v_reg);
-		errs( )<<"\nVreg : "<<v_reg<<" ---> Spilled";
+		LLVM_DEBUG(dbgs()<<"Empty potentialRegs\n");
+		notspilled = spillNode(v_reg);
+		LLVM_DEBUG(dbgs()<<"\nVreg : "<<v_reg<<" ---> Spilled");
 	}
 	else
 	{
@@ -385,52 +1006,142 @@ bool RegAllocGraphColoring::colorNode(unsigned v_reg)
 		//if no such register found due to interfernce with p_reg
 		if(!p_reg)
 		{
-			notspilled = SpillIt(v_reg);
-			errs( )<<"\nVreg : "<<v_reg<<" ---> Spilled\n";
+			notspilled = spillNode(v_reg);
+			LLVM_DEBUG(dbgs()<<"\nVreg : "<<v_reg<<" ---> Spilled\n");
 		}
 		else
 		{
 			//assigning virtual to physical register
 			vrm->assignVirt2Phys( v_reg , p_reg );
-			errs( )<<"\nVreg : "<<v_reg<<" ---> Preg :"<<TRI->getName(p_reg)<<"\n";
+			LLVM_DEBUG(dbgs()<<"\nVreg : "<<v_reg<<" ---> Preg :"<<TRI->getName(p_reg)<<"\n");
 			Colored.insert(v_reg);
+			InterferenceGraph.forEachNeighbor(v_reg, [&](unsigned n){
+				ForbiddenUnits[n] |= RegUnitMasks[p_reg];
+			});
+			for(unsigned m : CoalescedMembers[v_reg]){
+				vrm->assignVirt2Phys( m , p_reg );
+				Colored.insert(m);
+			}
 		}
 	}
 	return notspilled;
 }
 
-//This is the main graph coloring algorithm
-bool RegAllocGraphColoring::allocateRegisters()
+//This is the main graph coloring algorithm, run on the uncolored nodes in
+//Worklist; nodes outside it are already colored and only constrain select.
+//Simplify removes a node of minimum current degree, found with a bucket
+//queue indexed by degree, and pushes it on an explicit select stack.
+//When even the minimum degree node has at least as many neighbors as it has
+//registers, the node with the lowest spill weight per neighbor is pushed
+//instead, since it is the cheapest one to lose if select runs out of
+//registers (optimistic coloring): it is only spilled if no register is left
+//when it is popped.
+bool RegAllocGraphColoring::allocateRegisters(const vector<unsigned> &Worklist)
 {
-	bool round;
-	unsigned min;
-	bool flag = false;
-	//find virtual register with minimum degree
-	for(map<unsigned, set<unsigned> >::iterator ii = InterferenceGraph.begin(); ii != InterferenceGraph.end(); ii++)
+	//Degrees only count neighbors that are in the worklist
+	vector<uint64_t> Mask(InterferenceGraph.wordsPerRow(), 0);
+	for(unsigned v : Worklist)
+		Mask[v / 64] |= uint64_t(1) << (v % 64);
+	int MaxDegree = 0;
+	vector<float> Weight(InterferenceGraph.size(), 0);
+	vector<int> K(InterferenceGraph.size(), 0);
+	for(unsigned v : Worklist)
 	{
-		if(!OnStack[ii->first] && (flag == false || Degree[ii->first] < Degree[min]))
-			min = ii->first, flag = true;
-	}		
-	//if graph empty
-	if(flag == false)
-		return true;
-	errs()<<"\nRegister selected to push on stack = "<<min;
-
-	//push register onto stack
-	OnStack[min] = true;
+		OnStack[v] = false;
+		Degree[v] = InterferenceGraph.degreeMasked(v, Mask);
+		MaxDegree = std::max(MaxDegree, Degree[v]);
+		Weight[v] = spillWeight(v);
+		K[v] = numAllowedRegs(v);
+	}
 
-	//delete register from graph
-	for(map<unsigned, set<unsigned> >::iterator ii = InterferenceGraph.begin(); ii != InterferenceGraph.end(); ii++)
+	//units already taken by neighbors colored in earlier rounds
+	ForbiddenUnits.resize(InterferenceGraph.size(), BitVector(TRI->getNumRegUnits()));
+	for(unsigned v : Worklist)
 	{
-		if(ii->second.count(min))
-			Degree[ii->first]--;
+		ForbiddenUnits[v].reset();
+		InterferenceGraph.forEachNeighbor(v, [&](unsigned n){
+			if(Colored.count(n))
+				ForbiddenUnits[v] |= RegUnitMasks[vrm->getPhys(n)];
+		});
 	}
 
-	//recursive call
-	round = allocateRegisters();
+	//Spill candidates ordered by weight / degree. Degrees only drop, so the
+	//cost of a queued entry only rises; an entry whose cost is out of date is
+	//re-queued with the current one when it reaches the top.
+	auto cost = [&](unsigned v){ return Weight[v] / std::max(Degree[v], 1); };
+	typedef pair<float, unsigned> CostEntry;
+	priority_queue<CostEntry, vector<CostEntry>, greater<CostEntry>> SpillQueue;
+	for(unsigned v : Worklist)
+		SpillQueue.push({cost(v), v});
+	auto cheapestSpill = [&](){
+		while(true){
+			auto [c, v] = SpillQueue.top();
+			SpillQueue.pop();
+			if(OnStack[v])
+				continue;
+			if(c != cost(v)){
+				SpillQueue.push({cost(v), v});
+				continue;
+			}
+			return v;
+		}
+	};
+
+	//Buckets[d] holds nodes of degree d. A node is re-pushed whenever its
+	//degree drops, and entries whose degree is out of date are skipped.
+	vector<vector<unsigned>> Buckets(MaxDegree + 1);
+	for(unsigned v : Worklist)
+		Buckets[Degree[v]].push_back(v);
+
+	vector<unsigned> SelectStack;
+	SelectStack.reserve(Worklist.size());
+	int cur = 0;
+	while(SelectStack.size() < Worklist.size())
+	{
+		while(Buckets[cur].empty())
+			cur++;
+		unsigned min = Buckets[cur].back();
+		if(OnStack[min] || Degree[min] != cur)
+		{
+			Buckets[cur].pop_back();
+			continue;
+		}
+		if(cur < K[min])
+			Buckets[cur].pop_back();
+		else
+		{
+			//blocked: its bucket entry goes stale once it is on the stack
+			min = cheapestSpill();
+			LLVM_DEBUG(dbgs()<<"\nPotential spill = "<<min<<" weight "<<Weight[min]);
+		}
+		LLVM_DEBUG(dbgs()<<"\nRegister selected to push on stack = "<<min);
 
-	//pop and color virtual register
-	return colorNode(min) && round;
+		//push register onto stack
+		OnStack[min] = true;
+		SelectStack.push_back(min);
+
+		//delete register from graph
+		InterferenceGraph.forEachNeighbor(min, [&](unsigned n){
+			if(OnStack[n])
+				return;
+			Degree[n]--;
+			Buckets[Degree[n]].push_back(n);
+		});
+
+		//neighbors dropped by one at most, so the minimum is at least cur - 1
+		if(cur > 0)
+			cur--;
+	}
+
+	//pop and color virtual registers
+	bool round = true;
+	while(!SelectStack.empty())
+	{
+		unsigned v = SelectStack.back();
+		SelectStack.pop_back();
+		round = colorNode(v) && round;
+	}
+	return round;
 }
 
 
@@ -463,7 +1174,7 @@ void RegAllocGraphColoring::postOptimization() {
 
 bool RegAllocGraphColoring::runOnMachineFunction(MachineFunction &mf) 
 {
-	errs()<<"\nRunning On function: "<<mf.getFunction().getName();
+	LLVM_DEBUG(dbgs()<<"\nRunning On function: "<<mf.getFunction().getName());
 	MF = &mf;
 	mri = &MF->getRegInfo(); 
 	TRI = mf.getSubtarget().getRegisterInfo();
@@ -478,6 +1189,11 @@ bool RegAllocGraphColoring::runOnMachineFunction(MachineFunction &mf)
 	DefaultVRAI.calculateSpillWeightsAndHints();
 	VRegSpiller.reset(
 		createInlineSpiller(*this, *MF, *vrm, DefaultVRAI));
+	Loops = &getAnalysis<MachineLoopInfo>();
+	this->MBFI = &MBFI;
+	SA.reset(new SplitAnalysis(*vrm, *LI, *Loops));
+	SE.reset(new SplitEditor(*SA, *LI, *vrm, getAnalysis<MachineDominatorTree>(),
+							 MBFI, DefaultVRAI));
 
 	bool another_round = false;
 	int round = 1;
@@ -486,96 +1202,127 @@ bool RegAllocGraphColoring::runOnMachineFunction(MachineFunction &mf)
 	// errs()<<*vrm<<"\n";
 	// dumpPass();
 
-	preprocess();
+	computeRegUnitMasks();
+	{
+		NamedRegionTimer T("preprocess", "Preprocess", TimerGroupName,
+						   TimerGroupDescription, TimePassesIsEnabled);
+		preprocess();
+	}
 
-	if(!bigraphmatching()){	
+	Report.Functions = 1;
+	Report.Matched = bigraphmatching();
+	if(Report.Matched)
+		++NumMatched;
+	else{
 	// if(true){
+		++NumFallbacks;
+		vrm->clearAllVirt();
+		computeRegUnitMasks();
+		{
+			NamedRegionTimer T("build", "Build interference graph", TimerGroupName,
+							   TimerGroupDescription, TimePassesIsEnabled);
+			buildInterferenceGraph();
+		}
+		vector<unsigned> Worklist;
+		if(!ColorResult.empty())
+		{
+			//keep what is valid in the prediction, color only the rest
+			NamedRegionTimer T("repair", "Repair predicted coloring", TimerGroupName,
+							   TimerGroupDescription, TimePassesIsEnabled);
+			Worklist = repairPrediction();
+		}
+		else
+		{
+			NamedRegionTimer T("coalesce", "Coalesce copies", TimerGroupName,
+							   TimerGroupDescription, TimePassesIsEnabled);
+			coalesceCopies();
+			Worklist = IGNodes;
+		}
+		//Incremental rounds in a row before the whole graph is colored again
+		const int MaxIncrementalRounds = 8;
+		int Incremental = 0;
 		do
 		{
-			errs( )<<"\nRound #"<<round<<'\n';
+			LLVM_DEBUG(dbgs()<<"\nRound #"<<round<<'\n');
 			round++;
-			vrm->clearAllVirt();
-			buildInterferenceGraph();
-			another_round = allocateRegisters();
-			InterferenceGraph.clear( );
-			Degree.clear( );
-			OnStack.clear( );
-			Colored.clear();
-			Allocatable.clear();
-			errs( )<<*vrm<<"\n";
+			++NumRounds;
+			Report.Rounds++;
+			{
+				NamedRegionTimer T("select", "Simplify and select", TimerGroupName,
+								   TimerGroupDescription, TimePassesIsEnabled);
+				EvictOnFailure = !Colored.empty();
+				another_round = allocateRegisters(Worklist);
+			}
+			//only the intervals created by spilling need a color next round,
+			//unless one could not be colored around the fixed vregs
+			if(!another_round && (RebuildGraph || Incremental == MaxIncrementalRounds)){
+				NamedRegionTimer T("build", "Build interference graph", TimerGroupName,
+								   TimerGroupDescription, TimePassesIsEnabled);
+				rebuildInterferenceGraph();
+				Worklist = IGNodes;
+				Incremental = 0;
+			}
+			else if(!another_round){
+				NamedRegionTimer T("update", "Update interference graph", TimerGroupName,
+								   TimerGroupDescription, TimePassesIsEnabled);
+				Worklist = updateInterferenceGraph();
+				Incremental++;
+			}
+			LLVM_DEBUG(dbgs()<<*vrm<<"\n");
 		} while(!another_round);
+		//a coalesced copy is gone once both sides ended up in one register
+		for(auto [d, s] : CopyPairs)
+			if(CoalescedInto[d] == CoalescedInto[s] &&
+			   vrm->hasPhys(Register::index2VirtReg(d)) &&
+			   vrm->getPhys(Register::index2VirtReg(d)) == vrm->getPhys(Register::index2VirtReg(s)))
+			{
+				++NumCopiesRemoved;
+				Report.CopiesRemoved++;
+			}
+		InterferenceGraph.clear( );
+		IGNodes.clear( );
+		Degree.clear( );
+		OnStack.clear( );
+		Colored.clear();
+		Allocatable.clear();
+		SpillProducts.clear();
+		SpilledNodes.clear();
+		CoalescedInto.clear();
+		CoalescedMembers.clear();
+		CoalescedAllowed.clear();
+		CopyPairs.clear();
+		ForbiddenUnits.clear();
+		EvictOnFailure = false;
 		
 		postOptimization();
 	}
-	errs()<<"Pass after allocation\n";
-	errs()<<*vrm<<"\n";
+	LLVM_DEBUG(dbgs()<<"Pass after allocation\n");
+	LLVM_DEBUG(dbgs()<<*vrm<<"\n");
 
-	SlotIndexes& SI = getAnalysis<SlotIndexes>();
-	SI.releaseMemory();
-	SI.runOnMachineFunction(*MF);
+	{
+		NamedRegionTimer T("recompute", "Recompute live intervals", TimerGroupName,
+						   TimerGroupDescription, TimePassesIsEnabled);
+		SlotIndexes& SI = getAnalysis<SlotIndexes>();
+		SI.releaseMemory();
+		SI.runOnMachineFunction(*MF);
 
-	LiveIntervals& LI = getAnalysis<LiveIntervals>();
-	LI.releaseMemory();
-	LI.runOnMachineFunction(*MF);
+		LiveIntervals& LI = getAnalysis<LiveIntervals>();
+		LI.releaseMemory();
+		LI.runOnMachineFunction(*MF);
+	}
+	if(!ColorReportPath.empty() || AreStatisticsEnabled()){
+		measureAllocation(MBFI);
+		ModuleReport.add(Report);
+	}
+	if(!ColorReportPath.empty())
+		writeReport("function", MF->getName(), Report);
 	releaseMemory();
 
 	return true;
 }
 
-std::vector<unsigned> Readfile(string filename){
-	// Open the file
-    std::ifstream file(filename);
-    if (!file.is_open()) {
-        return {};
-    }
-
-    // Read the entire line
-    std::string line;
-    std::getline(file, line);
-
-    // Close the file
-    file.close();
-
-    // Process the values and store them in a vector
-    std::vector<unsigned> values;
-    std::istringstream iss(line);
-    unsigned value;
-    char comma;
-    
-    while (iss >> value) {
-        values.push_back(value);
-        iss >> comma;  // Read the comma
-    }
-
-    // Display the values in the vector (replace this with your logic)
-    return values;
-}
-
-unsigned RegAllocGraphColoring::find(unsigned x){
-	return UnionFind[x]==x ? x : UnionFind[x] = find(UnionFind[x]);
-}
-bool RegAllocGraphColoring::SameCongruenceClass(unsigned a, unsigned b){
-	unsigned fa = find(a), fb = find(b);
-	return fa==fb;
-}
-void RegAllocGraphColoring::join(unsigned a, unsigned b){
-	unsigned fa = find(a), fb = find(b);
-	UnionFind[fa] = fb;
-	return;
-}
-
-bool RegAllocGraphColoring::UnitOverlap(unsigned a, unsigned b){
-	MCRegister PRegA(a);
-	MCRegister PRegB(b);
-	for (MCRegUnitIterator Units(PRegA, TRI); Units.isValid(); ++Units) {
-		for (MCRegUnitIterator Units2(PRegB, TRI); Units2.isValid(); ++Units2){
-			// if two adjacent nodes have common unit, then fail check
-			if(*Units == *Units2) return true;
-		}
-	}
-	return false;
-}
 void RegAllocGraphColoring::preprocess(){
+	vector<Register> Regs;
 	for (unsigned i = 0, e = mri->getNumVirtRegs();i != e; ++i) {
 		Register ii = Register::index2VirtReg(i);
 		if (mri->reg_nodbg_empty(ii))
@@ -585,142 +1332,485 @@ void RegAllocGraphColoring::preprocess(){
 				continue;
 			unsigned ii_index = ii.virtRegIndex(); 
 			const TargetRegisterClass *trc = MF->getRegInfo().getRegClass(ii_index);
-			const LiveInterval &li = LI->getInterval(ii);
 			VRegAllowedMap[ii_index] = getSetofPotentialRegs(*trc,ii_index);
-			for (unsigned j = 0, e = mri->getNumVirtRegs();j != e; ++j) {
-				Register jj = Register::index2VirtReg(j);
-				if (mri->reg_nodbg_empty(jj))
-      				continue;
-        		if (LI->hasInterval(jj)) {
-					const LiveInterval &li2 = LI->getInterval(jj);
-					unsigned jj_index = jj.virtRegIndex();
-					if(jj_index == ii_index)
-						continue;
-					if(jj.isPhysical()) // same as before
-						continue;
-					if (li.overlaps(li2)) 
-					{
-						BoundedNodes.insert(ii_index);
-						break;
-					}
-				}
-			}
+			Regs.push_back(ii);
 		}
 	}
-	for (auto iter: VRegAllowedMap){
-		for (auto phyiter: iter.second) UnionFind[phyiter] = phyiter;
-	}
-
-	for(auto itera: UnionFind){
-		for(auto iterb: UnionFind){
-			if(itera!=iterb&&UnitOverlap(itera.first, iterb.first)&&!SameCongruenceClass(itera.first, iterb.first)){
-				join(itera.first, iterb.first);
-			}
+	// A node is bounded if it interferes with at least one other vreg of its
+	// register class partition
+	for(const vector<Register> &Part : partitionVRegs(Regs)){
+		SparseIG Graph = buildSparseIG(*LI, Part);
+		for (unsigned i = 0; i < Part.size(); i++){
+			if (Graph.degree(i))
+				BoundedNodes.insert(Part[i].virtRegIndex());
 		}
 	}
-	for(auto itera: UnionFind) find(itera.first);
-	for(auto iter:UnionFind){
-		CongruenceClass[iter.second].insert(iter.first);
-	}
+	// The model colors congruence classes, not registers
 	for(auto iter: VRegAllowedMap){
 		set<unsigned>tmp;
 		for(auto phyReg: iter.second){
-			tmp.insert(UnionFind[phyReg]);
+			tmp.insert(Congruence.Rep[phyReg]);
 		}
 		VRegAllowedMap[iter.first] = tmp;
 	}
 }
 
-void RegAllocGraphColoring::handle_color_result(){
+// Predict colors for partition P of the graphs X86IGGenerator emits for MF,
+// through the inference server, the in-process model or -color1-predictions.
+// Server and model colorings are looked up in -color1-cache first. Graph is
+// the interference graph of Regs, and Colors gets one color per node, 0 where
+// there is none.
+bool RegAllocGraphColoring::predictColors(unsigned P, ArrayRef<Register> Regs,
+										  const SparseIG &Graph, vector<unsigned> &Colors){
+	bool Infer = !ColorServerPath.empty() || !ColorModelPath.empty();
+	if(Infer && !ColorCacheDir.empty()){
+		if(!Cache && !CacheOpenFailed){
+			auto CacheOrErr = DLRegAllocCache::open(ColorCacheDir, ColorModelPath, ColorServerPath);
+			if(!CacheOrErr){
+				errs()<<"Prediction cache: "<<toString(CacheOrErr.takeError())<<"\n";
+				CacheOpenFailed = true;
+			}
+			else Cache = std::move(*CacheOrErr);
+		}
+		if(Cache && Cache->lookup(Graph, Colors)){
+			++NumCacheHits;
+			Report.CacheHits++;
+			return true;
+		}
+	}
+	if(!ColorServerPath.empty()){
+		if(Error E = queryColorServer(ColorServerPath, Graph, Colors)){
+			errs()<<"Inference server: "<<toString(std::move(E))<<"\n";
+			return false;
+		}
+		if(Cache)
+			Cache->store(Graph, Colors);
+		return true;
+	}
+	if(!ColorModelPath.empty()){
+		if(!Model && !ModelLoadFailed){
+			auto ModelOrErr = DLRegAllocModel::load(ColorModelPath);
+			if(!ModelOrErr){
+				errs()<<"Cannot load "<<ColorModelPath<<": "<<toString(ModelOrErr.takeError())<<"\n";
+				ModelLoadFailed = true;
+			}
+			else Model = std::move(*ModelOrErr);
+		}
+		if(!Model)
+			return false;
+		Model->predict(Graph, Colors);
+		if(Cache)
+			Cache->store(Graph, Colors);
+		return true;
+	}
+
+	if(!Predictions && !PredictionsLoadFailed){
+		auto FileOrErr = IGPredictionFile::open(ColorPredictionsPath);
+		if(!FileOrErr){
+			errs()<<"Cannot load "<<ColorPredictionsPath<<": "<<toString(FileOrErr.takeError())<<"\n";
+			PredictionsLoadFailed = true;
+		}
+		else Predictions = std::move(*FileOrErr);
+	}
+	if(!Predictions)
+		return false;
+	string name = partitionRecordName(MF->getName(), P);
+	const IGPredictionView *R = Predictions->lookup(name);
+	if(!R)
+		return false;
+	//a record predicted for another version of the function must not be
+	//applied to this one node by node
+	bool Same = R->VRegs.size() == Regs.size() && R->NumEdges == Graph.numEdges();
+	for(unsigned i = 0; Same && i < Regs.size(); i++)
+		Same = R->VRegs[i] == Regs[i].virtRegIndex();
+	if(!Same){
+		errs()<<ColorPredictionsPath<<": record "<<name<<" does not match the graph of the function\n";
+		return false;
+	}
+	Colors.assign(R->Colors.begin(), R->Colors.end());
+	return true;
+}
+
+// Fill ColorResult and AllocGraph, one register class partition at a time.
+// A chordal partition is colored optimally with colorChordal and needs no
+// prediction; every other one is predicted by predictColors. Colors of later
+// partitions are shifted past those of earlier ones, so no color is shared
+// between partitions. Returns false if some bounded node did not get a color.
+bool RegAllocGraphColoring::handle_color_result(){
 	// TODO: build AllocGraph that map color to a group of possible phyreg; read result into ColorResult; 
 	// AllocGraph: first collect vr that in the same color, then use intersection to narrow done
-	auto color_result = Readfile("/home/chrenx/Desktop/eecs583/final-project/demo/model_output.csv");
-	auto mapping = Readfile("/home/chrenx/Desktop/eecs583/final-project/demo/vr_tracking.csv");
-	for(unsigned i = 0, j = 0; i < color_result.size(); j++){
-		if(!BoundedNodes.count(mapping[j])) continue;
-		ColorResult[mapping[j]] = color_result[i];
-		if(!AllocGraph.count(color_result[i])) AllocGraph[color_result[i]] = VRegAllowedMap[mapping[j]];
+	vector<pair<unsigned, unsigned>> Predicted;
+	vector<vector<Register>> Parts = generatorPartitions();
+	unsigned Base = 0;
+	for(unsigned p = 0; p != Parts.size(); p++){
+		const vector<Register> &Regs = Parts[p];
+		SparseIG Graph = buildSparseIG(*LI, Regs);
+		vector<unsigned> Colors;
+		if(colorChordal(Graph, Colors)){
+			++NumChordal;
+			Report.Chordal++;
+		}
+		else if(!predictColors(p, Regs, Graph, Colors))
+			return false;
+		else if(!ColorDumpPath.empty())
+			dumpPrediction(p, Regs, Graph, Colors);
+		PartRegs.push_back(Regs);
+		PartGraphs.push_back(std::move(Graph));
+		unsigned MaxColor = 0;
+		for (unsigned i = 0; i < Regs.size(); i++){
+			unsigned index = Regs[i].virtRegIndex();
+			MaxColor = std::max(MaxColor, Colors[i]);
+			if(Colors[i] && BoundedNodes.count(index))
+				Predicted.push_back({index, Base + Colors[i]});
+		}
+		Base += MaxColor;
+	}
+	for(auto [vreg, color]: Predicted){
+		ColorResult[vreg] = color;
+		if(!AllocGraph.count(color)) AllocGraph[color] = VRegAllowedMap[vreg];
 		else{
 			std::set<unsigned> intersection;
 			// Use std::set_intersection to find the intersection
 			std::set_intersection(
-				AllocGraph[color_result[i]].begin(), AllocGraph[color_result[i]].end(),
-				VRegAllowedMap[mapping[j]].begin(), VRegAllowedMap[mapping[j]].end(),
+				AllocGraph[color].begin(), AllocGraph[color].end(),
+				VRegAllowedMap[vreg].begin(), VRegAllowedMap[vreg].end(),
 				std::inserter(intersection, intersection.begin())
 			);
-			AllocGraph[color_result[i]] = intersection;
+			AllocGraph[color] = intersection;
 		}	
-		i++;
 	}
+	for(unsigned vreg: BoundedNodes){
+		if(!ColorResult.count(vreg))
+			return false;
+	}
+	return true;
 }
 // Reference: https://oi-wiki.org/graph/graph-matching/bigraph-match/
 bool RegAllocGraphColoring::bigraphmatching(){
-	handle_color_result();
+	NamedRegionTimer T("matching", "Color prediction and matching", TimerGroupName,
+					   TimerGroupDescription, TimePassesIsEnabled);
+	if(!handle_color_result()){
+		LLVM_DEBUG(dbgs()<<"No color prediction for some virtual registers.");
+		return false;
+	}
+	if(matchColors() != AllocGraph.size()){
+		LLVM_DEBUG(dbgs()<<"Cannot assign color to physical register. Spilling needed.");
+		return false;
+	}
+	//Pick a register for every vreg before assigning any. A vreg left without
+	//one, or an edge whose ends got overlapping registers, sends the function
+	//to repairPrediction, which keeps the valid part and recolors the rest.
+	map<unsigned, unsigned> Chosen;
+	for(auto &[v, Allowed] : VRegAllowedMap){
+		unsigned Class;
+		if(BoundedNodes.count(v))
+			Class = ColorToReg[ColorResult[v]];
+		else if(!Allowed.empty())
+			Class = *Allowed.begin();
+		else{
+			LLVM_DEBUG(dbgs()<<"Cannot assign color to physical register. Spilling needed.");
+			return false;
+		}
+		for(unsigned r : Congruence.Members[Class]){
+			// the class spans the whole target, so skip registers this
+			// vreg may not use (reserved, clobbered or fixed interference)
+			if(compatible_class(*MF, v, r) && PotentialRegsCache[v].count(r)){
+				Chosen[v] = r;
+				break;
+			}
+		}
+		if(!Chosen.count(v)){
+			LLVM_DEBUG(dbgs()<<"\nNo register of the matched class for vreg "<<v);
+			return false;
+		}
+	}
+	unsigned Checked = 0;
+	for(unsigned p = 0; p != PartRegs.size(); p++){
+		const vector<Register> &Regs = PartRegs[p];
+		const SparseIG &Graph = PartGraphs[p];
+		for(unsigned i = 0; i < Regs.size(); i++){
+			auto Ri = Chosen.find(Regs[i].virtRegIndex());
+			if(Ri == Chosen.end())
+				continue;
+			Checked++;
+			for(unsigned j : Graph.neighbors(i)){
+				auto Rj = Chosen.find(Regs[j].virtRegIndex());
+				if(j > i && Rj != Chosen.end() &&
+				   RegUnitMasks[Ri->second].anyCommon(RegUnitMasks[Rj->second])){
+					LLVM_DEBUG(dbgs()<<"\nPredicted registers of vregs "<<Ri->first
+									<<" and "<<Rj->first<<" overlap");
+					return false;
+				}
+			}
+		}
+	}
+	//a vreg outside the partitions has edges nobody checked
+	if(Checked != Chosen.size())
+		return false;
+	LLVM_DEBUG(dbgs()<<"Happy Christmas!\n");
+	for(auto [v, r] : Chosen)
+		vrm->assignVirt2Phys(v, r);
+	return true;
+}
+// Hopcroft-Karp on the color -> congruence class graph, O(E sqrt(V)).
+// Colors are numbered by their position in AllocGraph, classes by their
+// representative register, and the adjacency lists are flattened into one
+// array. Each phase layers the graph with a BFS from the free colors and then
+// augments along vertex-disjoint shortest paths with an explicit DFS stack.
+// Fills ColorToReg and returns the size of the matching.
+unsigned RegAllocGraphColoring::matchColors() {
+	vector<unsigned> Colors, Offsets(1, 0), Adj;
+	for (auto &iter: AllocGraph) {
+		Colors.push_back(iter.first);
+		Adj.insert(Adj.end(), iter.second.begin(), iter.second.end());
+		Offsets.push_back(Adj.size());
+	}
+	unsigned L = Colors.size();
+	const unsigned Inf = ~0u;
+	vector<int> MatchL(L, -1), MatchR(TRI->getNumRegs(), -1);
+	vector<unsigned> Dist(L), Next(L), Queue, Stack;
+	unsigned Size = 0;
 	while (true) {
-      dfn++;
-      unsigned cnt = 0;
-      for (auto iter: AllocGraph) {
-        if (!pa.count(iter.first) && dfs(iter.first)) {
-          cnt++;
-        }
-      }
-      if (cnt == 0) {
-        break;
-      }
-      res += cnt;
-    }
-    if(res == AllocGraph.size()){
-		errs()<<"Happy Christmas!\n";
-		for(auto v_reg_color: VRegAllowedMap){
-			if(BoundedNodes.count(v_reg_color.first))
-			for(auto congruence: CongruenceClass[pa[ColorResult[v_reg_color.first]]]){
-				if(compatible_class(*MF,v_reg_color.first,congruence)){
-					vrm->assignVirt2Phys(v_reg_color.first, congruence);
-					break;
+		Queue.clear();
+		for (unsigned l = 0; l != L; ++l) {
+			Dist[l] = MatchL[l] < 0 ? 0 : Inf;
+			if (MatchL[l] < 0)
+				Queue.push_back(l);
+		}
+		bool Found = false;
+		for (size_t q = 0; q != Queue.size(); ++q) {
+			unsigned l = Queue[q];
+			for (unsigned e = Offsets[l]; e != Offsets[l + 1]; ++e) {
+				int m = MatchR[Adj[e]];
+				if (m < 0)
+					Found = true;
+				else if (Dist[m] == Inf) {
+					Dist[m] = Dist[l] + 1;
+					Queue.push_back(m);
 				}
 			}
-			else{
-				if(v_reg_color.second.empty()){
-					errs()<<"Cannot assign color to physical register. Spilling needed.";
-					return false;
+		}
+		if (!Found)
+			break;
+
+		for (unsigned l = 0; l != L; ++l)
+			Next[l] = Offsets[l];
+		for (unsigned root = 0; root != L; ++root) {
+			if (MatchL[root] >= 0)
+				continue;
+			Stack.assign(1, root);
+			while (!Stack.empty()) {
+				unsigned l = Stack.back();
+				if (Next[l] == Offsets[l + 1]) {
+					// dead end, never enter it again in this phase
+					Dist[l] = Inf;
+					Stack.pop_back();
+					continue;
 				}
-				else for(auto congruence: CongruenceClass[*v_reg_color.second.begin()]){
-					if(compatible_class(*MF,v_reg_color.first,congruence)){
-						vrm->assignVirt2Phys(v_reg_color.first, congruence);
-						break;
+				int m = MatchR[Adj[Next[l]]];
+				if (m < 0) {
+					// free class: flip every edge on the path
+					for (unsigned s : Stack) {
+						MatchL[s] = Adj[Next[s]];
+						MatchR[Adj[Next[s]]] = s;
 					}
+					Size++;
+					break;
 				}
+				if (Dist[m] == Dist[l] + 1)
+					Stack.push_back(m);
+				else
+					Next[l]++;
 			}
 		}
-		return true;
 	}
-	else{
-		errs()<<"Cannot assign color to physical register. Spilling needed.";
-		return false;
+
+	ColorToReg.assign(Colors.empty() ? 0 : Colors.back() + 1, 0);
+	for (unsigned l = 0; l != L; ++l)
+		if (MatchL[l] >= 0)
+			ColorToReg[Colors[l]] = MatchL[l];
+	return Size;
+}
+
+void RegAllocGraphColoring::FunctionReport::add(const FunctionReport &R) {
+	Functions += R.Functions;
+	Matched += R.Matched;
+	Chordal += R.Chordal;
+	CacheHits += R.CacheHits;
+	VRegs += R.VRegs;
+	Edges += R.Edges;
+	Rounds += R.Rounds;
+	Spills += R.Spills;
+	Splits += R.Splits;
+	Coalesced += R.Coalesced;
+	CopiesRemoved += R.CopiesRemoved;
+	RepairKept += R.RepairKept;
+	RepairRecolored += R.RepairRecolored;
+	SpillStores += R.SpillStores;
+	Reloads += R.Reloads;
+	Copies += R.Copies;
+	CalleeSaved += R.CalleeSaved;
+	SpillStoreCost += R.SpillStoreCost;
+	ReloadCost += R.ReloadCost;
+	CopyCost += R.CopyCost;
+	CalleeSavedCost += R.CalleeSavedCost;
+}
+
+// Static cost of the allocation of MF: the spill stores and reloads (folded
+// ones included) the spiller inserted, the copies whose two sides ended up in
+// different registers, and the callee-saved registers the assignment touches,
+// each of which costs a save and a restore at function entry and exit.
+void RegAllocGraphColoring::measureAllocation(const MachineBlockFrequencyInfo &MBFI) {
+	const MachineFrameInfo &MFI = MF->getFrameInfo();
+	auto isSpillSlotAccess = [&](ArrayRef<const MachineMemOperand *> Accesses) {
+		return llvm::any_of(Accesses, [&](const MachineMemOperand *A) {
+			return MFI.isSpillSlotObjectIndex(
+					cast<FixedStackPseudoSourceValue>(A->getPseudoValue())->getFrameIndex());
+		});
+	};
+	// register an operand ends up in once VirtRegRewriter has run
+	auto physOf = [&](const MachineOperand &MO) -> MCRegister {
+		Register R = MO.getReg();
+		MCRegister P = R.isVirtual() ? vrm->getPhys(R) : R.asMCReg();
+		if (P && MO.getSubReg())
+			P = TRI->getSubReg(P, MO.getSubReg());
+		return P;
+	};
+
+	for (MachineBasicBlock &MBB : *MF) {
+		double Freq = MBFI.getBlockFreqRelativeToEntryBlock(&MBB);
+		for (MachineInstr &MI : MBB) {
+			SmallVector<const MachineMemOperand *, 2> Accesses;
+			int FI;
+			if ((tii->isStoreToStackSlot(MI, FI) && MFI.isSpillSlotObjectIndex(FI)) ||
+			    (tii->hasStoreToStackSlot(MI, Accesses) && isSpillSlotAccess(Accesses))) {
+				Report.SpillStores++;
+				Report.SpillStoreCost += Freq;
+			} else if ((tii->isLoadFromStackSlot(MI, FI) && MFI.isSpillSlotObjectIndex(FI)) ||
+			           (tii->hasLoadFromStackSlot(MI, Accesses) && isSpillSlotAccess(Accesses))) {
+				Report.Reloads++;
+				Report.ReloadCost += Freq;
+			} else if (MI.isCopy() && physOf(MI.getOperand(0)) != physOf(MI.getOperand(1))) {
+				Report.Copies++;
+				Report.CopyCost += Freq;
+			}
+		}
 	}
-	
-}
-bool RegAllocGraphColoring::dfs(unsigned v) {
-    vis[v] = dfn;
-    for (unsigned u : AllocGraph[v]) {
-      if (!pb.count(u)) {
-        pb[u] = v;
-        pa[v] = u;
-        return true;
-      }
-    }
-    for (unsigned u : AllocGraph[v]) {
-      if (vis[pb[u]] != dfn && dfs(pb[u])) {
-        pa[v] = u;
-        pb[u] = v;
-        return true;
-      }
-    }
-    return false;
-  }
+
+	computeRegUnitMasks();
+	BitVector UsedUnits(TRI->getNumRegUnits());
+	for (unsigned i = 0, e = mri->getNumVirtRegs(); i != e; ++i) {
+		Register R = Register::index2VirtReg(i);
+		if (vrm->hasPhys(R))
+			UsedUnits |= RegUnitMasks[vrm->getPhys(R)];
+	}
+	for (const MCPhysReg *CSR = mri->getCalleeSavedRegs(); CSR && *CSR; ++CSR)
+		if (RegUnitMasks[*CSR].anyCommon(UsedUnits)) {
+			Report.CalleeSaved++;
+			Report.CalleeSavedCost += 2;
+		}
+
+	NumSpillStores += Report.SpillStores;
+	NumReloads += Report.Reloads;
+	NumCopiesLeft += Report.Copies;
+	NumCSRUsed += Report.CalleeSaved;
+}
+
+bool RegAllocGraphColoring::doFinalization(Module &M) {
+	if (!ColorReportPath.empty() && ModuleReport.Functions)
+		writeReport("module", M.getName(), ModuleReport);
+	ModuleReport = FunctionReport();
+	ReportStream.reset();
+	DumpStream.reset();
+	return false;
+}
+
+// Write the colors predictColors returned for partition P of MF to
+// -color1-dump-predictions, named like the record X86IGGenerator writes for it.
+void RegAllocGraphColoring::dumpPrediction(unsigned P, ArrayRef<Register> Regs,
+										   const SparseIG &Graph, ArrayRef<unsigned> Colors) {
+	if (!DumpStream) {
+		std::error_code EC;
+		DumpStream = std::make_unique<raw_fd_ostream>(ColorDumpPath, EC, sys::fs::OF_None);
+		if (EC) {
+			errs() << "Cannot open " << ColorDumpPath << ": " << EC.message() << "\n";
+			DumpStream.reset();
+			return;
+		}
+		writeIGPredictionHeader(*DumpStream);
+	}
+	vector<unsigned> VRegs;
+	for (Register R : Regs)
+		VRegs.push_back(R.virtRegIndex());
+	writeIGPredictionRecord(*DumpStream, partitionRecordName(MF->getName(), P), VRegs,
+							Graph, Colors);
+}
+
+// Append the counts of the current function to -color1-report as one JSON
+// line. The file is opened in append mode and every line is flushed on its
+// own, so parallel llc processes can share it.
+void RegAllocGraphColoring::writeReport(StringRef Key, StringRef Name,
+										const FunctionReport &R) {
+	if (!ReportStream) {
+		std::error_code EC;
+		ReportStream = std::make_unique<raw_fd_ostream>(ColorReportPath, EC,
+														sys::fs::OF_Append);
+		if (EC) {
+			errs() << "Cannot open " << ColorReportPath << ": " << EC.message() << "\n";
+			ReportStream.reset();
+			return;
+		}
+	}
+	std::string Line;
+	raw_string_ostream OS(Line);
+	json::OStream J(OS);
+	J.object([&] {
+		J.attribute(Key, Name);
+		J.attribute("functions", R.Functions);
+		J.attribute("matched", R.Matched);
+		J.attribute("chordal", R.Chordal);
+		J.attribute("cache_hits", R.CacheHits);
+		J.attribute("vregs", R.VRegs);
+		J.attribute("edges", R.Edges);
+		J.attribute("rounds", R.Rounds);
+		J.attribute("spills", R.Spills);
+		J.attribute("splits", R.Splits);
+		J.attribute("coalesced", R.Coalesced);
+		J.attribute("copies_removed", R.CopiesRemoved);
+		J.attribute("repair_kept", R.RepairKept);
+		J.attribute("repair_recolored", R.RepairRecolored);
+		J.attribute("spill_stores", R.SpillStores);
+		J.attribute("reloads", R.Reloads);
+		J.attribute("copies", R.Copies);
+		J.attribute("callee_saved", R.CalleeSaved);
+		J.attribute("spill_store_cost", R.SpillStoreCost);
+		J.attribute("reload_cost", R.ReloadCost);
+		J.attribute("copy_cost", R.CopyCost);
+		J.attribute("callee_saved_cost", R.CalleeSavedCost);
+		J.attribute("total_cost", R.SpillStoreCost + R.ReloadCost + R.CopyCost +
+								  R.CalleeSavedCost);
+	});
+	OS << "\n";
+	*ReportStream << OS.str();
+	ReportStream->flush();
+}
 
 void RegAllocGraphColoring::releaseMemory() {
   VRegSpiller.reset();
+  SE.reset();
+  SA.reset();
+  NoSplit.clear();
+  // Everything below describes one function; only the model, the congruence
+  // table and the prediction files are kept for the rest of the module.
+  PotentialRegsCache.clear();
+  VRegAllowedMap.clear();
+  BoundedNodes.clear();
+  PartRegs.clear();
+  PartGraphs.clear();
+  ColorResult.clear();
+  AllocGraph.clear();
+  ColorToReg.clear();
+  Report = FunctionReport();
 }
 FunctionPass *llvm::createColorRegisterAllocator() 
 {
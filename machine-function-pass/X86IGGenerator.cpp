@@ -15,6 +15,7 @@
 // #include "llvm/CodeGen/RegisterCoalescer.h"
 #include "llvm/CodeGen/LiveIntervals.h"
 #include "llvm/CodeGen/LiveInterval.h"
+#include "llvm/CodeGen/InterferenceGraph.h"
 #include "llvm/CodeGen/LiveStacks.h"
 #include "llvm/CodeGen/MachineFunctionPass.h"
 #include "llvm/CodeGen/MachineInstr.h"
@@ -25,32 +26,114 @@
 #include "llvm/CodeGen/RegAllocRegistry.h"
 #include "llvm/CodeGen/TargetRegisterInfo.h"
 #include "llvm/CodeGen/TargetInstrInfo.h"
+#include "llvm/CodeGen/TargetSubtargetInfo.h"
 #include "llvm/Target/TargetMachine.h"
 #include "llvm/Target/TargetOptions.h"
 #include "llvm/ADT/EquivalenceClasses.h"
 #include "llvm/ADT/BitVector.h"
 #include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Compiler.h"
+#include "llvm/Support/Compression.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/Timer.h"
 #include <algorithm>
+#include <atomic>
 #include <vector>
 #include <set>
 #include <map>
 #include <queue>
 #include <memory>
 #include <cmath>
+#include <string>
 
 using namespace llvm;
 
 #define X86_IG_GENERATOR_PASS_NAME "X86 interference graph generator pass"
+#define DEBUG_TYPE "x86-ig-generator"
+
+STATISTIC(NumGraphs, "Number of interference graphs written");
+STATISTIC(NumIGVRegs, "Number of vregs in interference graphs");
+STATISTIC(NumIGEdges, "Number of interference graph edges");
+STATISTIC(NumTrainingRecords, "Number of labeled training records written");
+STATISTIC(NumUnlabeled, "Number of functions without any allocated vreg after the allocator");
+
+static const char TimerGroupName[] = "x86-ig-generator";
+static const char TimerGroupDescription[] = X86_IG_GENERATOR_PASS_NAME;
+
+static cl::opt<std::string> IGOutput(
+    "ig-output", cl::init("interference.%p.%t.igb"), cl::Hidden,
+    cl::desc("Interference graph stream to write. %p expands to the process "
+             "id and %t to a per-process pass instance number, so parallel "
+             "code generation threads and processes get their own file; a "
+             "path without %t is refused by all but the first instance"));
+
+static cl::opt<std::string> TrainingDataDir(
+    "ig-training-data", cl::Hidden,
+    cl::desc("Instead of -ig-output, write every graph labeled with the "
+             "register allocation to compressed shards in this directory. "
+             "The pass must run between the allocator and the rewriter"));
+
+static cl::opt<unsigned> TrainingShardMB(
+    "ig-shard-mb", cl::init(64), cl::Hidden,
+    cl::desc("Start a new training data shard after this many megabytes"));
+
+static cl::opt<bool> IGDisable(
+    "ig-disable", cl::init(false), cl::Hidden,
+    cl::desc("Neither build nor write any graph, e.g. when timing the "
+             "register allocators (see demo/benchmark.py)"));
 
 namespace {
 
-std::vector<std::vector<unsigned>> InterferenceGraph; 
-std::map<unsigned, unsigned> NumPhysicalRegisters; // type: num of physical registers
+// Shards written by -ig-training-data, one open shard per pass instance.
+// File names are made unique with random characters, so any number of llc
+// processes can write to one directory. Every field is a little-endian uint32:
+//   shard <name>.igt: magic "IGT1", version, codec (0 = stored, 1 = zlib),
+//                     then one block per record: stored size S, record
+//                     size R, S bytes padded to 4
+//   record:           an IGB record (see InterferenceGraph.h), Labels[N]
+//   index <name>.idx: magic "IGX1", version, then for every record: block
+//                     offset (low word, high word), N, name length L,
+//                     name bytes padded to 4
+// Labels[i] is the congruence class of the register node i got, numbered
+// from 1 in order of first use, or 0 if it got none.
+class TrainingShardWriter {
+  std::string Dir;
+  uint64_t ShardLimit;
+  std::unique_ptr<raw_fd_ostream> Shard, Index;
+  bool Compress = false;
+
+  Error openShard();
+
+public:
+  TrainingShardWriter(StringRef Dir, uint64_t ShardLimit)
+      : Dir(Dir.str()), ShardLimit(ShardLimit) {}
+  Error write(StringRef Name, ArrayRef<unsigned> VRegs, const SparseIG &G,
+              ArrayRef<unsigned> Labels);
+};
 
 class X86IGGenerator : public MachineFunctionPass {
   private:
+    // Per-function state, owned by the pass instance so that every code
+    // generation thread has its own.
+    // One graph and vreg table (node -> virtual register index) per
+    // register class partition, see computeClassPartitions
+    std::vector<SparseIG> InterferenceCSR;
+    std::vector<std::vector<unsigned>> VRTracking;
+    const TargetRegisterInfo *PartitionTRI = nullptr;
+    std::vector<unsigned> ClassPartition;
+    CongruenceTable Congruence; // labels of -ig-training-data, per target
+    std::unique_ptr<TrainingShardWriter> TrainingData;
+    // Set once this instance has seen an allocation, i.e. it is the one
+    // that runs after the allocator in -ig-training-data mode
+    bool AfterAllocation = false;
+
     bool belongToSameClass(Register reg1, Register reg2);
+    bool hasAllocation() const;
+    void writeTrainingRecords();
 
   public:
     static char ID;
@@ -92,9 +175,17 @@ class X86IGGenerator : public MachineFunctionPass {
       //if(StrongPHIElim)
       //	AU.addRequiredID(StrongPHIEliminationID);
       AU.addRequired<VirtRegMap>();
+      // Only reads, so the allocation survives when this runs before the
+      // rewriter in -ig-training-data mode
+      AU.setPreservesAll();
       MachineFunctionPass::getAnalysisUsage(AU);
     }
     
+    // One append-only stream per module, one record per function
+    std::unique_ptr<raw_fd_ostream> IGStream;
+    bool doInitialization(Module &M) override;
+    bool doFinalization(Module &M) override;
+
     bool runOnMachineFunction(MachineFunction &mf) override;
     void printFunction();
     void buildInterferenceGraph();
@@ -108,6 +199,78 @@ char X86IGGenerator::ID = 0;
 
 //=============================== Private ====================================//
 
+Error TrainingShardWriter::openShard() {
+  if (std::error_code EC = sys::fs::create_directories(Dir))
+    return createStringError(EC, "cannot create " + Dir);
+  SmallString<256> Model(Dir);
+  sys::path::append(Model, "shard-%%%%%%%%%%%%%%%%.igt");
+  int FD;
+  SmallString<256> Path;
+  if (std::error_code EC = sys::fs::createUniqueFile(Model, FD, Path))
+    return createStringError(EC, "cannot create a shard in " + Dir);
+  Shard = std::make_unique<raw_fd_ostream>(FD, /*shouldClose=*/true);
+  std::string IndexPath = (Path.substr(0, Path.size() - 4) + ".idx").str();
+  std::error_code EC;
+  Index = std::make_unique<raw_fd_ostream>(IndexPath, EC, sys::fs::OF_None);
+  if (EC)
+    return createStringError(EC, "cannot create the index of " + Path);
+
+  Compress = compression::zlib::isAvailable();
+  support::endian::Writer SW(*Shard, support::little);
+  Shard->write("IGT1", 4);
+  SW.write<uint32_t>(1);
+  SW.write<uint32_t>(Compress ? 1 : 0);
+  support::endian::Writer IW(*Index, support::little);
+  Index->write("IGX1", 4);
+  IW.write<uint32_t>(1);
+  return Error::success();
+}
+
+Error TrainingShardWriter::write(StringRef Name, ArrayRef<unsigned> VRegs,
+                                 const SparseIG &G, ArrayRef<unsigned> Labels) {
+  if (!Shard || Shard->tell() >= ShardLimit) {
+    Shard.reset();
+    Index.reset();
+    if (Error E = openShard())
+      return E;
+  }
+
+  SmallString<1024> Record;
+  raw_svector_ostream RS(Record);
+  writeIGRecord(RS, Name, VRegs, G);
+  support::endian::Writer RW(RS, support::little);
+  for (unsigned L : Labels)
+    RW.write<uint32_t>(L);
+  ArrayRef<uint8_t> Raw(reinterpret_cast<const uint8_t *>(Record.data()),
+                        Record.size());
+  SmallVector<uint8_t, 0> Compressed;
+  if (Compress)
+    compression::zlib::compress(Raw, Compressed);
+  ArrayRef<uint8_t> Block = Compress ? ArrayRef<uint8_t>(Compressed) : Raw;
+
+  uint64_t Offset = Shard->tell();
+  support::endian::Writer SW(*Shard, support::little);
+  SW.write<uint32_t>(Block.size());
+  SW.write<uint32_t>(Raw.size());
+  Shard->write(reinterpret_cast<const char *>(Block.data()), Block.size());
+  Shard->write_zeros(alignTo(Block.size(), 4) - Block.size());
+
+  support::endian::Writer IW(*Index, support::little);
+  IW.write<uint32_t>(Offset & 0xffffffff);
+  IW.write<uint32_t>(Offset >> 32);
+  IW.write<uint32_t>(G.size());
+  IW.write<uint32_t>(Name.size());
+  *Index << Name;
+  Index->write_zeros(alignTo(Name.size(), 4) - Name.size());
+  if (Shard->has_error() || Index->has_error()) {
+    std::error_code EC = Shard->has_error() ? Shard->error() : Index->error();
+    Shard->clear_error();
+    Index->clear_error();
+    return createStringError(EC, "cannot write a shard in " + Dir);
+  }
+  return Error::success();
+}
+
 // Check whether two VRs are of the same type
 bool X86IGGenerator::belongToSameClass(Register reg1, Register reg2) {
   // LOG("这里1"); LOG("\n");
@@ -129,9 +292,7 @@ void X86IGGenerator::buildInterferenceGraph() {
 
   std::vector<MachineInstr *> vr_def;
   std::vector<Register> virtual_registers;
-  FILE* fp_vr = fopen("vr_tracking.csv", "w");
-
-  bool first_vr_flag = true;
+  std::vector<unsigned> vr_index;
 	for (unsigned i = 0; i < mri->getNumVirtRegs(); i++) {
 		Register ii = Register::index2VirtReg(i);
     if (mri->getVRegDef(ii) == nullptr || mri->reg_nodbg_empty(ii) || !ii.isVirtual()) {
@@ -141,17 +302,11 @@ void X86IGGenerator::buildInterferenceGraph() {
       mri->getVRegDef(ii)->print(errs());
       errs() << "  :" << mri->getVRegName(ii) << "\n";
 #endif
-      if (first_vr_flag) {
-        fprintf(fp_vr, "%u", i);
-        first_vr_flag = false;
-      } else {
-        fprintf(fp_vr, ", %u", i);
-      }
+      vr_index.push_back(i);
       virtual_registers.push_back(ii);
       vr_def.push_back(mri->getVRegDef(ii));
     }
 	}
-  fclose(fp_vr);
 
   // LOG("查看vr\n");
   // for (int i = 0; i < (int)virtual_registers.size(); i++) {
@@ -159,52 +314,62 @@ void X86IGGenerator::buildInterferenceGraph() {
   // }
   // LOG("\n");
   
-  InterferenceGraph.resize(virtual_registers.size(), 
-                           std::vector<unsigned>(virtual_registers.size()));
-
-  // build interference graph by checking overlapping live interval
-  for (unsigned i = 0; i < virtual_registers.size(); i++) {
-    Register ii = virtual_registers[i];
-    if (LI->hasInterval(ii)) {
-			if(ii.isPhysical()) 
-				continue;
-			const LiveInterval &li = LI->getInterval(ii); 
-			// InterferenceGraph[i][i] = 1;  不给自己有interference
-			for (unsigned j = i + 1; j < virtual_registers.size(); ++j) {
-				Register jj = virtual_registers[j];
-        if (LI->hasInterval(jj)) {
-					// if(jj.isPhysical() || !belongToSameClass(ii, jj)) {
-          if(jj.isPhysical()) {
-            // LOG("\n+++++++++++++++++++++++++\n")
-						continue;
-          }
-					const LiveInterval &li2 = LI->getInterval(jj);
-          // LOG("++++++++++++++++++++\n")
-          // li2.print(errs());
-          // LOG("\n++++++++++++++++++++")
-					if (li.overlaps(li2)) {
-						InterferenceGraph[i][j] = 1;
-						InterferenceGraph[j][i] = 1;
+  // build one interference graph per register class partition by sweeping
+  // the sorted live segments; vregs of different partitions never interfere
+  const TargetRegisterInfo *TRI = MF->getSubtarget().getRegisterInfo();
+  if (PartitionTRI != TRI) {
+    PartitionTRI = TRI;
+    ClassPartition = computeClassPartitions(*TRI);
+    if (TrainingData)
+      Congruence = buildCongruenceTable(*TRI);
+  }
+  for (const std::vector<unsigned> &Part :
+       partitionRegs(*mri, ClassPartition, virtual_registers)) {
+    std::vector<Register> Regs;
+    std::vector<unsigned> VRegs;
+    for (unsigned n : Part) {
+      Regs.push_back(virtual_registers[n]);
+      VRegs.push_back(vr_index[n]);
+    }
+    InterferenceCSR.push_back(buildSparseIG(*LI, Regs));
+    VRTracking.push_back(VRegs);
+    const SparseIG &G = InterferenceCSR.back();
 #ifdef DEBUG
-            LOG("这里有interference:\n");
-            vr_def[i]->print(errs());
-            vr_def[j]->print(errs());
-            LOG("\n");
+    for (unsigned i = 0; i < G.size(); i++) {
+      for (unsigned j : G.neighbors(i)) {
+        if (j < i)
+          continue;
+        LOG("这里有interference:\n");
+        vr_def[Part[i]]->print(errs());
+        vr_def[Part[j]]->print(errs());
+        LOG("\n");
+      }
+    }
 #endif
-					}
-				}
-			}
-		}	
+    NumIGEdges += G.numEdges();
   }
 
-  // print 2d vector for debug
+  NumIGVRegs += virtual_registers.size();
+
+#ifdef DEBUG
+  // print 2d vector for debug, assembled from the partition graphs
+  std::map<unsigned, unsigned> Position;
+  for (unsigned n = 0; n < vr_index.size(); n++)
+    Position[vr_index[n]] = n;
+  IGBitMatrix InterferenceGraph;
+  InterferenceGraph.reset(virtual_registers.size());
+  for (unsigned P = 0; P < InterferenceCSR.size(); P++)
+    for (unsigned i = 0; i < InterferenceCSR[P].size(); i++)
+      for (unsigned j : InterferenceCSR[P].neighbors(i))
+        InterferenceGraph.addEdge(Position[VRTracking[P][i]],
+                                  Position[VRTracking[P][j]]);
   errs() << "# of virtual reg: " << virtual_registers.size() << "\n";
   errs() << "Interference Graph (adjacency matrix)------------\n";
   for (unsigned int i = 0; i < InterferenceGraph.size(); i++) {
     errs() << "[";
-    for (unsigned int j = 0; j < InterferenceGraph[0].size(); j++) {
-      errs() << InterferenceGraph[i][j];
-      if (j != InterferenceGraph[0].size() - 1) {
+    for (unsigned int j = 0; j < InterferenceGraph.size(); j++) {
+      errs() << InterferenceGraph.hasEdge(i, j);
+      if (j != InterferenceGraph.size() - 1) {
         errs() << ", ";
       } else {
         errs() << "]\n";
@@ -212,48 +377,56 @@ void X86IGGenerator::buildInterferenceGraph() {
     }
   }
   errs() << "\n";
+#endif
 }
 
-// Output interference graphs
+// Append this function's graphs and vreg tables to the module stream
 void X86IGGenerator::printInterferenceGraph() {
   LOG("Running printInterferenceGraph()"); LOG("\n");
-	FILE* fp = fopen("interference.csv", "w");
-  
-  // add # of optimal color used at the beginning
-  fprintf(fp, "%u, ", mri->getNumVirtRegs());
-
-  unsigned long long adBits = 0;
-	for (unsigned int i = 0; i < InterferenceGraph.size(); i++) {
-    unsigned int criteria = std::min(64, (int)InterferenceGraph.size());
-
-    // Write the first LONG
-    for (unsigned int j = 0; j < criteria; j++) {
-      if (InterferenceGraph[i][j]) {
-        unsigned long long one = 1 << j;
-        adBits |= one;
+  if (!IGStream)
+    return;
+  NamedRegionTimer T("write", "Write interference graph", TimerGroupName,
+                     TimerGroupDescription, TimePassesIsEnabled);
+  for (unsigned P = 0; P < InterferenceCSR.size(); P++) {
+    writeIGRecord(*IGStream, partitionRecordName(MF->getName(), P),
+                  VRTracking[P], InterferenceCSR[P]);
+    ++NumGraphs;
+  }
+}
+
+// Whether the allocator has assigned a register to any vreg of MF yet
+bool X86IGGenerator::hasAllocation() const {
+  for (unsigned i = 0, e = mri->getNumVirtRegs(); i != e; ++i)
+    if (vrm->hasPhys(Register::index2VirtReg(i)))
+      return true;
+  return false;
+}
+
+// Label every graph with the allocation of the register allocator that ran
+// before this pass and append it to the training shards
+void X86IGGenerator::writeTrainingRecords() {
+  NamedRegionTimer T("write", "Write interference graph", TimerGroupName,
+                     TimerGroupDescription, TimePassesIsEnabled);
+  for (unsigned P = 0; P < InterferenceCSR.size(); P++) {
+    std::map<unsigned, unsigned> ColorOf; // class representative -> label
+    std::vector<unsigned> Labels;
+    for (unsigned v : VRTracking[P]) {
+      Register R = Register::index2VirtReg(v);
+      if (!vrm->hasPhys(R)) {
+        Labels.push_back(0);
+        continue;
       }
+      unsigned Rep = Congruence.Rep[vrm->getPhys(R)];
+      Labels.push_back(ColorOf.emplace(Rep, ColorOf.size() + 1).first->second);
     }
-    fprintf(fp, "%llu, ", adBits); 
-    
-    // Write the second LONG
-    adBits = 0;
-    for (unsigned int j = criteria; j < InterferenceGraph.size(); j++) {
-      if (InterferenceGraph[i][j]) {
-        unsigned long long one = 1 << j;
-        adBits |= one;
-      }
+    if (Error E = TrainingData->write(partitionRecordName(MF->getName(), P),
+                                      VRTracking[P], InterferenceCSR[P], Labels)) {
+      errs() << toString(std::move(E)) << "\n";
+      TrainingData.reset();
+      return;
     }
-    fprintf(fp, "%llu, ", adBits); 
-  }
-	
-  for (unsigned int k = 0; k < (100 - InterferenceGraph.size()); k++) {
-    fprintf(fp, "%llu, ", (unsigned)0); 
-    fprintf(fp, "%llu, ", (unsigned)0); 
+    ++NumTrainingRecords;
   }
-  for (unsigned int k = 0; k < 100; k++) {
-    fprintf(fp, "%llu, ", (unsigned)0); 
-  }
-  fclose(fp);
 }
 
 void X86IGGenerator::printFunction() {
@@ -265,8 +438,68 @@ void X86IGGenerator::printFunction() {
   }
 }
 
+// Expand %p and %t in the -ig-output pattern. Returns an empty path for a
+// pattern without %t once another pass instance of this process has taken it,
+// since both would truncate the same file.
+static std::string expandIGOutputPath(StringRef Pattern) {
+  static std::atomic<unsigned> NextInstance{0};
+  unsigned Instance = NextInstance++;
+  if (Instance > 0 && !Pattern.contains("%t"))
+    return std::string();
+  std::string Path;
+  for (size_t i = 0; i < Pattern.size(); i++) {
+    if (Pattern[i] == '%' && i + 1 < Pattern.size()) {
+      if (Pattern[i + 1] == 'p') {
+        Path += std::to_string(sys::Process::getProcessId());
+        i++;
+        continue;
+      }
+      if (Pattern[i + 1] == 't') {
+        Path += std::to_string(Instance);
+        i++;
+        continue;
+      }
+    }
+    Path += Pattern[i];
+  }
+  return Path;
+}
+
+bool X86IGGenerator::doInitialization(Module &M) {
+  if (IGDisable)
+    return false;
+  if (!TrainingDataDir.empty()) {
+    TrainingData = std::make_unique<TrainingShardWriter>(
+        TrainingDataDir, (uint64_t)TrainingShardMB << 20);
+    return false;
+  }
+  std::string Path = expandIGOutputPath(IGOutput);
+  if (Path.empty()) {
+    errs() << "-ig-output=" << IGOutput << " is shared by several pass "
+           << "instances; add %t to the path\n";
+    return false;
+  }
+  std::error_code EC;
+  IGStream = std::make_unique<raw_fd_ostream>(Path, EC, sys::fs::OF_None);
+  if (EC) {
+    errs() << "Cannot open " << Path << ": " << EC.message() << "\n";
+    IGStream.reset();
+    return false;
+  }
+  writeIGStreamHeader(*IGStream);
+  return false;
+}
+
+bool X86IGGenerator::doFinalization(Module &M) {
+  IGStream.reset();
+  TrainingData.reset();
+  return false;
+}
+
 // Run machine function pass
 bool X86IGGenerator::runOnMachineFunction(MachineFunction &mf) {
+  if (IGDisable)
+    return false;
   LOG("\nRunning IGGenerator On function: "); LOG(mf.getFunction().getName()); LOG("\n");
   MF = &mf;
   TM = &MF->getTarget();
@@ -276,10 +509,29 @@ bool X86IGGenerator::runOnMachineFunction(MachineFunction &mf) {
   LOG("\n++++++++++++++++++++++++++++++++\n");
   // printFunction();
   LOG("++++++++++++++++++++++++++++++++\n");
-	buildInterferenceGraph();
-	printInterferenceGraph();
-	InterferenceGraph.clear( );
-	return true;
+  // In -ig-training-data mode the instance that runs before the allocator
+  // has nothing to label, so it does not build the graphs at all
+  if (TrainingData) {
+    vrm = &getAnalysis<VirtRegMap>();
+    if (!hasAllocation()) {
+      if (AfterAllocation)
+        ++NumUnlabeled;
+      return false;
+    }
+    AfterAllocation = true;
+  }
+  {
+    NamedRegionTimer T("build", "Build interference graph", TimerGroupName,
+                       TimerGroupDescription, TimePassesIsEnabled);
+    buildInterferenceGraph();
+  }
+	if (TrainingData)
+		writeTrainingRecords();
+	else
+		printInterferenceGraph();
+	InterferenceCSR.clear();
+	VRTracking.clear();
+	return false;
 }
 
 INITIALIZE_PASS_BEGIN(X86IGGenerator, "x86-ig-generator", X86_IG_GENERATOR_PASS_NAME, true, true)